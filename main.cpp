@@ -8,110 +8,1190 @@
 #include <filesystem>
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <array>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_X86_DISPATCH 1 // векторные варианты пакетного DCT и обновления особей, выбираются по процессору во время запуска
+#endif
 using namespace std;
 
+#ifdef COUNT_ALLOCATIONS
+// Подсчет выделений памяти в куче (сборка с -DCOUNT_ALLOCATIONS), выводится в main bench
+atomic<long long> allocation_count(0);
+void* operator new(size_t size) {
+    allocation_count++;
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw bad_alloc();
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void* operator new(size_t size, align_val_t align) {
+    allocation_count++;
+    if (void* ptr = aligned_alloc(size_t(align), (size + size_t(align) - 1) / size_t(align) * size_t(align)))
+        return ptr;
+    throw bad_alloc();
+}
+void operator delete(void* ptr, align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t, align_val_t) noexcept { free(ptr); }
+#endif
+
 int sign(double x){
     // Функция определяет знак числа
     return (x > 0) - (x < 0);
 }
 
+inline uint64_t mix64(uint64_t z) {
+    // Перемешивание 64-битного числа (финализатор splitmix64)
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t hash_name(const string& name) {
+    // Хеш строки FNV-1a - одинаковый на всех платформах, в отличие от std::hash
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (unsigned char c : name)
+        h = (h ^ c) * 0x100000001B3ull;
+    return h;
+}
+
+uint64_t stream_key(uint64_t seed, uint64_t picture, uint64_t block, uint64_t optimizer, uint64_t iteration = 0) {
+    /*
+        Ключ потока случайных чисел для заданной части эксперимента
+        Один и тот же набор (seed, картинка, блок, метаэвристика, итерация) всегда дает одну и ту же
+        последовательность, независимо от числа потоков и порядка обработки блоков
+    */
+    uint64_t key = mix64(seed + 0x9E3779B97F4A7C15ull);
+    for (uint64_t part : {picture, block, optimizer, iteration})
+        key = mix64(key ^ (part + 0x9E3779B97F4A7C15ull + (key << 6) + (key >> 2)));
+    return key;
+}
+
+// Номер "блока" для потока, из которого берется порядок обхода блоков картинки
+const uint64_t BLOCK_ORDER_STREAM = ~uint64_t(0);
+
+class Philox4x32{
+    /*
+    *   Счетный (counter-based) генератор случайных чисел Philox4x32-10
+        Очередное значение - это шифр от пары (ключ, номер), поэтому поток полностью задается ключом,
+        не зависит от истории вызовов в других потоках и хранит всего 48 байт состояния
+        Удовлетворяет требованиям UniformRandomBitGenerator, поэтому подходит для shuffle и распределений
+    */
+    private:
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t output[4];
+    int available; // сколько 32-битных значений из output еще не выдано
+
+    void generate() {
+        uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+        uint32_t k[2] = {key[0], key[1]};
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = uint64_t(0xD2511F53u) * c[0];
+            uint64_t p1 = uint64_t(0xCD9E8D57u) * c[2];
+            uint32_t n0 = uint32_t(p1 >> 32) ^ c[1] ^ k[0];
+            uint32_t n2 = uint32_t(p0 >> 32) ^ c[3] ^ k[1];
+            c[0] = n0;
+            c[1] = uint32_t(p1);
+            c[2] = n2;
+            c[3] = uint32_t(p0);
+            k[0] += 0x9E3779B9u;
+            k[1] += 0xBB67AE85u;
+        }
+        for (int i = 0; i < 4; i++)
+            output[i] = c[i];
+        available = 4;
+        // переход к следующему значению 128-битного счетчика
+        for (int i = 0; i < 4 && ++counter[i] == 0; i++) {}
+    }
+
+    public:
+    typedef uint64_t result_type;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+
+    explicit Philox4x32(uint64_t stream = 0) { seed(stream); }
+
+    void seed(uint64_t stream) {
+        // Начало потока с ключом stream и нулевым счетчиком
+        key[0] = uint32_t(stream);
+        key[1] = uint32_t(stream >> 32);
+        counter[0] = counter[1] = counter[2] = counter[3] = 0;
+        available = 0;
+    }
+
+    result_type operator()() {
+        if (available < 2)
+            generate();
+        uint64_t result = (uint64_t(output[4 - available]) << 32) | output[5 - available];
+        available -= 2;
+        return result;
+    }
+};
+
+typedef Philox4x32 RandomEngine;
+
+RandomEngine& thread_rng() {
+    /*
+        Генератор текущего потока
+        Пока поток не задан через RandomStream, ключ берется от random_device (запуск невоспроизводим)
+    */
+    thread_local RandomEngine rng((uint64_t(random_device()()) << 32) ^ random_device()());
+    return rng;
+}
+
+class RandomStream{
+    /*
+    *   Переключает генератор текущего потока на поток с заданным ключом на время жизни объекта
+        По окончании восстанавливается прежнее состояние генератора
+    */
+    private:
+    RandomEngine saved;
+
+    public:
+    explicit RandomStream(uint64_t key) : saved(thread_rng()) { thread_rng().seed(key); }
+    ~RandomStream() { thread_rng() = saved; }
+    RandomStream(const RandomStream&) = delete;
+    RandomStream& operator=(const RandomStream&) = delete;
+};
+
+inline double random_unit(RandomEngine& rng) {
+    // Равномерное число в [0, 1) из старших 53 бит
+    return double(rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline int random_bounded(RandomEngine& rng, int low, int high) {
+    // Равномерное целое число в [low, high] без смещения (метод Лемира)
+    uint64_t range = uint64_t(int64_t(high) - low) + 1;
+    uint64_t x = rng() >> 32;
+    uint64_t m = x * range;
+    if ((m & 0xFFFFFFFFull) < range) {
+        uint64_t threshold = (0x100000000ull - range) % range;
+        while ((m & 0xFFFFFFFFull) < threshold) {
+            x = rng() >> 32;
+            m = x * range;
+        }
+    }
+    return int(int64_t(low) + int64_t(m >> 32));
+}
+
+void fill_uniform(double* out, size_t size, double low, double high) {
+    // Заполнение массива равномерными числами из [low, high)
+    RandomEngine& rng = thread_rng();
+    for (size_t i = 0; i < size; i++)
+        out[i] = low + (high - low) * random_unit(rng);
+}
+
+void fill_uniform_int(int* out, size_t size, int low, int high) {
+    // Заполнение массива равномерными целыми числами из [low, high]
+    RandomEngine& rng = thread_rng();
+    for (size_t i = 0; i < size; i++)
+        out[i] = random_bounded(rng, low, high);
+}
+
+double getRandomValue(double low, double high) {
+    // Функция генерирует случайное нецелое число в интервале (low,high)
+    return low + (high - low) * random_unit(thread_rng());
+}
+
+int getRandomIndex(int population_size) {
+    // Функция генерирует рандомное целое число - индекс для особи в популяции
+    return random_bounded(thread_rng(), 0, population_size - 1);
+}
+
+double getRandomInteger(int search_space) {
+    // Функция генерирует случайное целое число
+    return double(random_bounded(thread_rng(), -search_space, search_space));
+}
+
+class ThreadPool{
+    /*
+    *   Пул потоков для параллельной обработки независимых задач
+        parallel_for раздает номера задач через общий атомарный счетчик: освободившийся поток сразу
+        берет следующую задачу, поэтому долгие задачи не задерживают остальные потоки
+        Вызвавший поток тоже выполняет задачи; вложенный вызов parallel_for из задачи выполняется
+        последовательно в том же потоке
+    */
+    private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    const void* body = nullptr; // задача и функция ее вызова (без std::function, чтобы не выделять память)
+    void (*invoke)(const void*, size_t) = nullptr;
+    size_t count = 0;
+    atomic<size_t> next{0};
+    size_t generation = 0; // номер текущего вызова parallel_for
+    size_t finished_workers = 0; // сколько рабочих потоков закончили текущий вызов
+    bool stopping = false;
+    exception_ptr error;
+
+    static bool& inside_task() {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    void run_tasks() {
+        inside_task() = true;
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                invoke(body, i);
+            }
+            catch (...) {
+                lock_guard<mutex> guard(lock);
+                if (!error)
+                    error = current_exception();
+            }
+        }
+        inside_task() = false;
+    }
+
+    void worker_loop() {
+        size_t seen = 0;
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            guard.unlock();
+            run_tasks();
+            guard.lock();
+            if (++finished_workers == workers.size())
+                finished.notify_all();
+        }
+    }
+
+    public:
+    explicit ThreadPool(unsigned threads) {
+        // threads - общее число потоков вместе с вызывающим
+        for (unsigned t = 1; t < threads; t++)
+            workers.emplace_back([this] { worker_loop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers)
+            worker.join();
+    }
+
+    size_t size() const { return workers.size() + 1; }
+
+    class SerialScope{
+        // Пока объект жив, parallel_for в этом потоке выполняется последовательно: для собственных потоков,
+        // которые не должны раздавать задачи пулу одновременно с другими (run_concurrently)
+        private:
+        bool saved;
+
+        public:
+        SerialScope() : saved(inside_task()) { inside_task() = true; }
+        ~SerialScope() { inside_task() = saved; }
+    };
+
+    template <class Task>
+    void parallel_for(size_t task_count, const Task& task) {
+        // Выполнение task(0), ..., task(task_count - 1) на всех потоках пула
+        if (workers.empty() || inside_task() || task_count < 2) {
+            for (size_t i = 0; i < task_count; i++)
+                task(i);
+            return;
+        }
+        run(task_count, &task, [](const void* body, size_t i) { (*static_cast<const Task*>(body))(i); });
+    }
+
+    private:
+    void run(size_t task_count, const void* task, void (*task_invoke)(const void*, size_t)) {
+        {
+            lock_guard<mutex> guard(lock);
+            body = task;
+            invoke = task_invoke;
+            count = task_count;
+            next = 0;
+            finished_workers = 0;
+            error = nullptr;
+            generation++;
+        }
+        wake.notify_all();
+        run_tasks();
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return finished_workers == workers.size(); });
+        body = nullptr;
+        if (error)
+            rethrow_exception(error);
+    }
+};
+
+ThreadPool& thread_pool(unsigned threads = 0) {
+    /*
+        Общий пул потоков программы, создается при первом вызове
+        threads - число потоков (0 - по числу ядер процессора), учитывается только при первом вызове
+    */
+    static ThreadPool pool(threads ? threads : max(1u, thread::hardware_concurrency()));
+    return pool;
+}
+
+template <class Task>
+void run_concurrently(size_t task_count, const Task& task) {
+    /*
+        Одновременное выполнение task(0), ..., task(task_count - 1): task(0) - в вызывающем потоке, остальные -
+        в собственных потоках, поэтому задачи идут одновременно и внутри задачи пула, где parallel_for
+        выполнил бы их по очереди; в собственных потоках parallel_for выполняется последовательно
+        Для задач, которые во время работы обмениваются данными или останавливают друг друга (острова ISLANDS)
+    */
+    vector<exception_ptr> errors(task_count);
+    vector<thread> threads;
+    for (size_t k = 1; k < task_count; k++)
+        threads.emplace_back([&, k] {
+            ThreadPool::SerialScope serial;
+            try {
+                task(k);
+            }
+            catch (...) {
+                errors[k] = current_exception();
+            }
+        });
+    try {
+        if (task_count)
+            task(0);
+    }
+    catch (...) {
+        errors[0] = current_exception();
+    }
+    for (thread& worker : threads)
+        worker.join();
+    for (exception_ptr& error : errors)
+        if (error)
+            rethrow_exception(error);
+}
+
+// Этапы встраивания, время которых учитывается отдельно
+enum CostPhase { PHASE_DECODE, PHASE_DCT, PHASE_POPULATION, PHASE_PROJECT, PHASE_OPTIMIZE, PHASE_WRITE, PHASE_COUNT };
+const char* const PHASE_NAMES[PHASE_COUNT] = {"decode", "dct", "population", "project", "optimize", "write"};
+
+struct Cost{
+    /*
+    *   Затраты на часть эксперимента: оценки особей, преобразования DCT, попадания в кэш оценок и время по этапам
+        Время этапа - суммарное время всех потоков, работавших на этапе, в микросекундах
+    */
+    long long evaluations = 0;
+    long long dct = 0;
+    long long idct = 0;
+    long long cache_hits = 0; // оценки, взятые из кэша метрики без подсчета
+    long long incremental = 0; // оценки, посчитанные от состояния родителя (Metric::evaluate_delta)
+    long long screened = 0; // кандидаты, отсеянные по предсказанию метрики без полной оценки
+    double phase_us[PHASE_COUNT] = {};
+
+    Cost& operator+=(const Cost& other) {
+        evaluations += other.evaluations;
+        dct += other.dct;
+        idct += other.idct;
+        cache_hits += other.cache_hits;
+        incremental += other.incremental;
+        screened += other.screened;
+        for (int i = 0; i < PHASE_COUNT; i++)
+            phase_us[i] += other.phase_us[i];
+        return *this;
+    }
+};
+
+class CostAccumulator{
+    /*
+    *   Счетчики затрат, в которые могут одновременно писать несколько потоков
+    */
+    public:
+    atomic<long long> evaluations{0}, dct{0}, idct{0}, cache_hits{0}, incremental{0}, screened{0};
+    atomic<long long> phase_ns[PHASE_COUNT];
+
+    CostAccumulator() {
+        for (atomic<long long>& phase : phase_ns)
+            phase = 0;
+    }
+
+    Cost snapshot() const {
+        Cost cost;
+        cost.evaluations = evaluations.load(memory_order_relaxed);
+        cost.dct = dct.load(memory_order_relaxed);
+        cost.idct = idct.load(memory_order_relaxed);
+        cost.cache_hits = cache_hits.load(memory_order_relaxed);
+        cost.incremental = incremental.load(memory_order_relaxed);
+        cost.screened = screened.load(memory_order_relaxed);
+        for (int i = 0; i < PHASE_COUNT; i++)
+            cost.phase_us[i] = phase_ns[i].load(memory_order_relaxed) / 1000.0;
+        return cost;
+    }
+};
+
+CostAccumulator*& current_cost() {
+    // Счетчики, куда текущий поток записывает затраты (nullptr - затраты не учитываются)
+    thread_local CostAccumulator* current = nullptr;
+    return current;
+}
+
+class CostScope{
+    /*
+    *   Направляет затраты текущего потока в заданные счетчики на время жизни объекта
+    */
+    private:
+    CostAccumulator* saved;
+
+    public:
+    explicit CostScope(CostAccumulator* cost) : saved(current_cost()) { current_cost() = cost; }
+    ~CostScope() { current_cost() = saved; }
+    CostScope(const CostScope&) = delete;
+    CostScope& operator=(const CostScope&) = delete;
+};
+
+inline void count_cost(atomic<long long> CostAccumulator::* counter, long long amount = 1) {
+    // Увеличение счетчика затрат текущего потока
+    if (CostAccumulator* cost = current_cost())
+        (cost->*counter).fetch_add(amount, memory_order_relaxed);
+}
+
+class PhaseTimer{
+    /*
+    *   Замер времени этапа: от создания до stop() или уничтожения объекта
+    */
+    private:
+    CostPhase phase;
+    chrono::steady_clock::time_point start;
+    bool running = true;
+
+    public:
+    explicit PhaseTimer(CostPhase phase) : phase(phase), start(chrono::steady_clock::now()) {}
+    ~PhaseTimer() { stop(); }
+
+    void stop() {
+        if (!running)
+            return;
+        running = false;
+        if (CostAccumulator* cost = current_cost())
+            cost->phase_ns[phase].fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(),
+                                            memory_order_relaxed);
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
 vector <int> generate_blocks(int size){
     // Функция генерирует рандомную перестановку блоков с заданным размером
     vector <int> permutation;
     for (int i = 0; i < size; i++) {
         permutation.push_back(i);
     }   
-    random_device rd;
-    mt19937 gen(rd());
-    shuffle(permutation.begin(), permutation.end(), gen);
+    shuffle(permutation.begin(), permutation.end(), thread_rng());
     return permutation;
 }
 
-vector<vector<double>> do_dct(const vector<vector<int>>& input) {
+// Размер блока, с которым работают встраивание, метрика и DCT
+const int BLOCK_SIZE = 8;
+const int BLOCK_AREA = BLOCK_SIZE * BLOCK_SIZE;
+
+// Блок 8x8 в построчном порядке: элемент [i][j] лежит по индексу i * 8 + j
+typedef array<double, BLOCK_AREA> Block;
+typedef array<int, BLOCK_AREA> PixelBlock;
+
+struct DctBasis {
     /*
-        Функция преобразует значения пикселей в DCT-coef
-        На вход принимается блок изображения
-        На выходе блок dct-коэффициентов 
+        Таблица косинусов для DCT-II размера 8, посчитанная один раз при запуске
+        basis[k][n] = c(k) * cos(pi * (2n + 1) * k / 16), c(0) = sqrt(1/8), c(k) = sqrt(2/8)
+        Нормировка совпадает с cv::dct, поэтому коэффициенты получаются те же
     */
-
-    // Перевод из формата <vector> в формат <Mat>
-    cv::Mat floatInput(input.size(), input[0].size(), CV_64FC1); //CV_64FC1 WAS
-    for (size_t i = 0; i < input.size(); i++) {
-        for (size_t j = 0; j < input[0].size(); j++) {
-            floatInput.at<double>(i, j) = static_cast<double>(input[i][j]);
+    double basis[BLOCK_SIZE][BLOCK_SIZE];
+    double basis_t[BLOCK_SIZE][BLOCK_SIZE]; // транспонированная таблица для пакетного обратного преобразования
+    // двумерные базисные функции для обновления блока по одному элементу:
+    // coef_to_pixel[e] - вклад единичного DCT-coef e во все пиксели, pixel_to_coef[p] - вклад пикселя p во все DCT-coef
+    double coef_to_pixel[BLOCK_SIZE * BLOCK_SIZE][BLOCK_SIZE * BLOCK_SIZE];
+    double pixel_to_coef[BLOCK_SIZE * BLOCK_SIZE][BLOCK_SIZE * BLOCK_SIZE];
+
+    DctBasis() {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            double c = (k == 0) ? sqrt(1.0 / BLOCK_SIZE) : sqrt(2.0 / BLOCK_SIZE);
+            for (int n = 0; n < BLOCK_SIZE; n++) {
+                basis[k][n] = c * cos(M_PI * (2 * n + 1) * k / (2.0 * BLOCK_SIZE));
+                basis_t[n][k] = basis[k][n];
+            }
         }
+        for (int e = 0; e < BLOCK_SIZE * BLOCK_SIZE; e++)
+            for (int p = 0; p < BLOCK_SIZE * BLOCK_SIZE; p++) {
+                coef_to_pixel[e][p] = basis[e / BLOCK_SIZE][p / BLOCK_SIZE] * basis[e % BLOCK_SIZE][p % BLOCK_SIZE];
+                pixel_to_coef[p][e] = coef_to_pixel[e][p];
+            }
     }
+};
 
-    // Преобразование матрицы в DCT-coef
-    cv::Mat dctResult;
-    cv::dct(floatInput, dctResult);
+const DctBasis DCT_BASIS;
 
-    // Сохранение матрицы в виде вектора, вывод вектора
-    vector<vector<double>> output(dctResult.rows, vector<double>(dctResult.cols));
-    for (int i = 0; i < dctResult.rows; i++) {
-        for (int j = 0; j < dctResult.cols; j++) {
-            output[i][j] = dctResult.at<double>(i, j);
+void dct_8x8(const double* input, double* output) {
+    /*
+        Прямое DCT-II блока 8x8 без выделения памяти
+        Преобразование разделимое: сначала по строкам, затем по столбцам
+        input, output - 64 значения в построчном порядке (могут совпадать)
+    */
+    count_cost(&CostAccumulator::dct);
+    const double (*b)[BLOCK_SIZE] = DCT_BASIS.basis;
+    double tmp[BLOCK_AREA];
+
+    // строки: tmp[i][k] = sum_n input[i][n] * b[k][n]
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        const double* row = input + i * BLOCK_SIZE;
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            double sum = 0.0;
+            for (int n = 0; n < BLOCK_SIZE; n++)
+                sum += row[n] * b[k][n];
+            tmp[i * BLOCK_SIZE + k] = sum;
+        }
+    }
+    // столбцы: output[k][j] = sum_i b[k][i] * tmp[i][j]
+    for (int k = 0; k < BLOCK_SIZE; k++) {
+        for (int j = 0; j < BLOCK_SIZE; j++) {
+            double sum = 0.0;
+            for (int i = 0; i < BLOCK_SIZE; i++)
+                sum += b[k][i] * tmp[i * BLOCK_SIZE + j];
+            output[k * BLOCK_SIZE + j] = sum;
         }
     }
+}
 
+void idct_8x8(const double* input, double* output) {
+    /*
+        Обратное преобразование (DCT-III) блока 8x8 без выделения памяти
+        input, output - 64 значения в построчном порядке (могут совпадать)
+    */
+    count_cost(&CostAccumulator::idct);
+    const double (*b)[BLOCK_SIZE] = DCT_BASIS.basis;
+    double tmp[BLOCK_AREA];
+
+    // строки: tmp[i][n] = sum_k input[i][k] * b[k][n]
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        const double* row = input + i * BLOCK_SIZE;
+        for (int n = 0; n < BLOCK_SIZE; n++) {
+            double sum = 0.0;
+            for (int k = 0; k < BLOCK_SIZE; k++)
+                sum += row[k] * b[k][n];
+            tmp[i * BLOCK_SIZE + n] = sum;
+        }
+    }
+    // столбцы: output[m][n] = sum_i b[i][m] * tmp[i][n]
+    for (int m = 0; m < BLOCK_SIZE; m++) {
+        for (int n = 0; n < BLOCK_SIZE; n++) {
+            double sum = 0.0;
+            for (int i = 0; i < BLOCK_SIZE; i++)
+                sum += b[i][m] * tmp[i * BLOCK_SIZE + n];
+            output[m * BLOCK_SIZE + n] = sum;
+        }
+    }
+}
+
+void dct_8x8(const PixelBlock& input, Block& output) {
+    // Прямое DCT для блока пикселей
+    for (int i = 0; i < BLOCK_AREA; i++)
+        output[i] = static_cast<double>(input[i]);
+    dct_8x8(output.data(), output.data());
+}
+
+void idct_8x8(const Block& input, PixelBlock& output) {
+    /*
+        Обратное DCT с переводом в целые значения пикселей
+        Значения округляются до ближайшего целого: при отбрасывании дробной части
+        idct(dct(p)) для целого блока p мог терять единицу из-за погрешности порядка 1e-13
+    */
+    Block pixels;
+    idct_8x8(input.data(), pixels.data());
+    for (int i = 0; i < BLOCK_AREA; i++)
+        output[i] = static_cast<int>(floor(pixels[i] + 0.5));
+}
+
+PixelBlock flatten_block(const vector<vector<int>>& block) {
+    // Перевод блока 8x8 из формата <vector> в построчный массив
+    PixelBlock flat;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            flat[i * BLOCK_SIZE + j] = block[i][j];
+    return flat;
+}
+
+vector<vector<double>> do_dct(const vector<vector<int>>& input) {
+    /*
+        Функция преобразует значения пикселей в DCT-coef
+        На вход принимается блок изображения 8x8
+        На выходе блок dct-коэффициентов 
+    */
+    Block coefs;
+    dct_8x8(flatten_block(input), coefs);
+
+    vector<vector<double>> output(BLOCK_SIZE, vector<double>(BLOCK_SIZE));
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            output[i][j] = coefs[i * BLOCK_SIZE + j];
     return output;
 }
 
 vector<vector<int>> undo_dct(const vector<vector<double>>& dctCoefficients) {
     /*
         Функция преобразует DCT-coef обратно в пиксели
-        На вход получаем блок DCT-coef
+        На вход получаем блок DCT-coef 8x8
         На выходе получаем блок значений пикселей изображения
     */
+    Block coefs;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            coefs[i * BLOCK_SIZE + j] = dctCoefficients[i][j];
+
+    PixelBlock pixels;
+    idct_8x8(coefs, pixels);
+
+    vector<vector<int>> output(BLOCK_SIZE, vector<int>(BLOCK_SIZE));
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            output[i][j] = pixels[i * BLOCK_SIZE + j];
+    return output;
+}
+
+/*
+    Пакетное DCT для многих блоков 8x8 сразу
+    Блоки хранятся в формате structure-of-arrays: элемент e блока b лежит по индексу e * count + b,
+    поэтому одинаковые элементы всех блоков идут подряд и обрабатываются векторными командами
+    Один проход - одномерное преобразование вдоль строк (along_rows) или столбцов всех блоков:
+    out[line][k] = sum_n m[k][n] * in[line][n]
+    Порядок сложений такой же, как в dct_8x8/idct_8x8, поэтому результат совпадает побитово
+*/
+typedef void (*DctPass)(const double* input, double* output, size_t count, const double (*m)[BLOCK_SIZE], bool along_rows);
+
+inline size_t soa_index(int line, int k, bool along_rows) {
+    // Номер элемента блока для k-го значения на линии line
+    return along_rows ? line * BLOCK_SIZE + k : k * BLOCK_SIZE + line;
+}
 
-    // Перевод из формата <vector> в формат <Mat>
-    cv::Mat dctResult(dctCoefficients.size(), dctCoefficients[0].size(), CV_64FC1); //CV_64FC1 WAS
-    for (size_t i = 0; i < dctCoefficients.size(); i++) {
-        for (size_t j = 0; j < dctCoefficients[0].size(); j++) {
-            dctResult.at<double>(i, j) = dctCoefficients[i][j];
+void dct_pass_scalar(const double* input, double* output, size_t count, const double (*m)[BLOCK_SIZE], bool along_rows) {
+    for (int line = 0; line < BLOCK_SIZE; line++) {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            double* out = output + soa_index(line, k, along_rows) * count;
+            for (size_t b = 0; b < count; b++) {
+                double sum = 0.0;
+                for (int n = 0; n < BLOCK_SIZE; n++)
+                    sum += input[soa_index(line, n, along_rows) * count + b] * m[k][n];
+                out[b] = sum;
+            }
         }
     }
+}
 
-    // Обратное DCT-преобразование, получаем значения пикселей
-    cv::Mat idctResult;
-    cv::idct(dctResult, idctResult);
+#ifdef SIMD_X86_DISPATCH
+__attribute__((target("sse2")))
+void dct_pass_sse2(const double* input, double* output, size_t count, const double (*m)[BLOCK_SIZE], bool along_rows) {
+    for (int line = 0; line < BLOCK_SIZE; line++) {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            double* out = output + soa_index(line, k, along_rows) * count;
+            size_t b = 0;
+            for (; b + 2 <= count; b += 2) {
+                __m128d sum = _mm_setzero_pd();
+                for (int n = 0; n < BLOCK_SIZE; n++) {
+                    __m128d x = _mm_loadu_pd(input + soa_index(line, n, along_rows) * count + b);
+                    sum = _mm_add_pd(sum, _mm_mul_pd(x, _mm_set1_pd(m[k][n])));
+                }
+                _mm_storeu_pd(out + b, sum);
+            }
+            for (; b < count; b++) { // остаток, не поместившийся в регистр
+                double sum = 0.0;
+                for (int n = 0; n < BLOCK_SIZE; n++)
+                    sum += input[soa_index(line, n, along_rows) * count + b] * m[k][n];
+                out[b] = sum;
+            }
+        }
+    }
+}
 
-    // Конвертируем из формата <Mat> в <vector> и выводим его
-    vector<vector<int>> output(idctResult.rows, vector<int>(idctResult.cols));
-    for (int i = 0; i < idctResult.rows; i++) {
-        for (int j = 0; j < idctResult.cols; j++) {
-            output[i][j] = static_cast<int>(idctResult.at<double>(i, j));
+__attribute__((target("avx2")))
+void dct_pass_avx2(const double* input, double* output, size_t count, const double (*m)[BLOCK_SIZE], bool along_rows) {
+    for (int line = 0; line < BLOCK_SIZE; line++) {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            double* out = output + soa_index(line, k, along_rows) * count;
+            size_t b = 0;
+            for (; b + 4 <= count; b += 4) {
+                __m256d sum = _mm256_setzero_pd();
+                for (int n = 0; n < BLOCK_SIZE; n++) {
+                    __m256d x = _mm256_loadu_pd(input + soa_index(line, n, along_rows) * count + b);
+                    sum = _mm256_add_pd(sum, _mm256_mul_pd(x, _mm256_set1_pd(m[k][n])));
+                }
+                _mm256_storeu_pd(out + b, sum);
+            }
+            for (; b < count; b++) { // остаток, не поместившийся в регистр
+                double sum = 0.0;
+                for (int n = 0; n < BLOCK_SIZE; n++)
+                    sum += input[soa_index(line, n, along_rows) * count + b] * m[k][n];
+                out[b] = sum;
+            }
         }
     }
+}
+#endif
+
+DctPass select_dct_pass() {
+    // Выбор самой быстрой реализации, которую поддерживает процессор
+#ifdef SIMD_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return dct_pass_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return dct_pass_sse2;
+#endif
+    return dct_pass_scalar;
+}
 
-    return output;
+const DctPass DCT_PASS = select_dct_pass();
+
+double* dct_batch_scratch(size_t size) {
+    // Промежуточный буфер пакетного DCT, свой для каждого потока и переиспользуемый между вызовами
+    thread_local vector<double> scratch;
+    if (scratch.size() < size)
+        scratch.resize(size);
+    return scratch.data();
 }
 
-vector<vector<double>> embed_to_dct(vector<vector<double>> dct_matrix, const string bit_string, const char mode = 'A', double q = 8.0){
+void dct_8x8_batch(const double* input, double* output, size_t count) {
+    /*
+        Прямое DCT сразу для count блоков в формате structure-of-arrays
+        input, output - по 64 * count значений (могут совпадать)
+    */
+    count_cost(&CostAccumulator::dct, count);
+    double* tmp = dct_batch_scratch(BLOCK_AREA * count);
+    DCT_PASS(input, tmp, count, DCT_BASIS.basis, true);
+    DCT_PASS(tmp, output, count, DCT_BASIS.basis, false);
+}
+
+void idct_8x8_batch(const double* input, double* output, size_t count) {
+    /*
+        Обратное DCT сразу для count блоков в формате structure-of-arrays
+        input, output - по 64 * count значений (могут совпадать)
+    */
+    count_cost(&CostAccumulator::idct, count);
+    double* tmp = dct_batch_scratch(BLOCK_AREA * count);
+    DCT_PASS(input, tmp, count, DCT_BASIS.basis_t, true);
+    DCT_PASS(tmp, output, count, DCT_BASIS.basis_t, false);
+}
+
+void block_from_soa(const double* soa, size_t count, size_t index, double* block) {
+    // Чтение блока под номером index из пакета формата structure-of-arrays
+    for (int e = 0; e < BLOCK_AREA; e++)
+        block[e] = soa[e * count + index];
+}
+
+// Количество бит, встраиваемых в один блок (1 бит-флаг + 31 бит информации)
+const int EMBED_BITS = 32;
+
+struct EmbedPositions {
+    /*
+        Номера DCT-coef блока (в построчном порядке), в которые встраиваются биты, в порядке встраивания:
+        в строке i берутся последние элементы, начиная с правого края - высокочастотная область блока
+    */
+    array<int, EMBED_BITS> index;
+
+    EmbedPositions() {
+        int ind = 0;
+        int cntj = 6;
+        for (int i = 0; i < BLOCK_SIZE; i++){
+            for (int j = BLOCK_SIZE - 1; j > cntj; j--)
+                index[ind++] = i * BLOCK_SIZE + j;
+            if (i == 3) continue; // для обхода только нужных элементов для встраивания
+            cntj--;
+        }
+    }
+};
+
+const EmbedPositions EMBED_POSITIONS;
+
+// Бит-флаг "в блок встроена информация" - старший бит 32-битной порции блока
+const uint32_t EMBED_FLAG = 1u << (EMBED_BITS - 1);
+
+inline uint32_t payload_bit(uint32_t payload, int ind) {
+    // Бит порции под номером ind в порядке встраивания (0 - бит-флаг, он же старший бит)
+    return (payload >> (EMBED_BITS - 1 - ind)) & 1u;
+}
+
+inline uint32_t payload_mask(int length) {
+    // Маска первых length бит порции в порядке встраивания
+    return length >= EMBED_BITS ? 0xFFFFFFFFu : ~(0xFFFFFFFFu >> length);
+}
+
+inline int popcount32(uint32_t x) {
+    // Количество единичных бит
+#ifdef __GNUC__
+    return __builtin_popcount(x);
+#else
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    return int((((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+#endif
+}
+
+class BitVector{
+    /*
+    *   Упакованная битовая строка для встраиваемого и извлеченного сообщения
+        Биты хранятся по 64 в слове, бит под номером i - это (i % 64)-й бит слова i / 64, считая от старшего
+    */
+    private:
+    vector<uint64_t> words;
+    size_t length = 0;
+
+    public:
+    static BitVector from_string(const string& text) {
+        // Разбор строки из символов '0'/'1' (остальные символы пропускаются)
+        BitVector bits;
+        for (char c : text)
+            if (c == '0' || c == '1')
+                bits.push_back(c == '1');
+        return bits;
+    }
+
+    size_t size() const { return length; }
+
+    bool get(size_t i) const {
+        return (words[i / 64] >> (63 - i % 64)) & 1u;
+    }
+
+    void push_back(bool bit) {
+        if (length % 64 == 0)
+            words.push_back(0);
+        if (bit)
+            words[length / 64] |= uint64_t(1) << (63 - length % 64);
+        length++;
+    }
+
+    void append(uint32_t value, int count) {
+        // Добавление младших count бит value, начиная со старшего из них
+        for (int k = count - 1; k >= 0; k--)
+            push_back((value >> k) & 1u);
+    }
+
+    uint32_t chunk(size_t pos, int count) const {
+        /*
+            Порция из count бит (count <= 32), начиная с бита pos, прижатая к младшим разрядам
+            Биты за концом строки считаются нулевыми
+        */
+        uint32_t value = 0;
+        for (int k = 0; k < count; k++)
+            value = (value << 1) | ((pos + k < length) ? uint32_t(get(pos + k)) : 0u);
+        return value;
+    }
+
+    string to_string() const {
+        string text(length, '0');
+        for (size_t i = 0; i < length; i++)
+            if (get(i))
+                text[i] = '1';
+        return text;
+    }
+};
+
+void embed_to_dct(Block& dct_matrix, uint32_t payload, const char mode = 'A', double q = 8.0){
     /*
     *   Функция реализует встраивание в блок с DCT-coef
     *   На входе:
-        dct_matrix - блок dct-coef
-        bit_string - встраиваемая строка
+        dct_matrix - блок dct-coef, в который встраиваются биты
+        payload - встраиваемые 32 бита (первым встраивается старший бит)
         mode - выбранный тип работы, "A" - встроить 32 бита, иначе только 1 бит
         q - шаг квантования
+    */
+    int bits_count = (mode == 'A') ? EMBED_BITS : 1;
+    for (int ind = 0; ind < bits_count; ind++){
+        double& coef = dct_matrix[EMBED_POSITIONS.index[ind]];
+        coef = sign(coef) * (q * int(abs(coef) / q) + (q/2) * payload_bit(payload, ind));
+    }
+}
+
+vector<vector<double>> embed_to_dct(vector<vector<double>> dct_matrix, uint32_t payload, const char mode = 'A', double q = 8.0){
+    /*
+    *   Функция реализует встраивание в блок с DCT-coef в формате <vector>
     *   Функция выводит блок dct-coef со встроенными значениями бит
     */
-    int ind = 0;
-    int cntj = 6;
-    for (int i = 0; i < dct_matrix.size(); i++){
-        for (int j = dct_matrix[0].size() - 1; j > cntj; j--){
-            dct_matrix[i][j] = sign(dct_matrix[i][j]) * (q * int(abs(dct_matrix[i][j]) / q) + (q/2) * (int(bit_string[ind]) - int('0')));
-            if (mode != 'A') return dct_matrix; // возвращаем со встроенным одним битом
-            ind++;
+    Block coefs;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            coefs[i * BLOCK_SIZE + j] = dct_matrix[i][j];
+    embed_to_dct(coefs, payload, mode, q);
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        for (int j = 0; j < BLOCK_SIZE; j++)
+            dct_matrix[i][j] = coefs[i * BLOCK_SIZE + j];
+    return dct_matrix;
+}
+
+void project_to_bits(Block& dct_matrix, uint32_t payload, const char mode = 'A', double q = 8.0, double margin = 0.75){
+    /*
+    *   Функция сдвигает встраиваемые DCT-coef в ближайшую точку интервала, из которого извлекается их бит
+        (остаток |coef| mod q в [0, q/4) - бит 0, в [q/4, q) - бит 1), суженного на margin с каждой стороны -
+        запас на погрешность округления пикселей
+        Коэффициент, уже лежащий в таком интервале, не меняется, поэтому искажение меньше, чем у embed_to_dct,
+        который ставит коэффициенты на границу интервала бита 0
+    */
+    int bits_count = (mode == 'A') ? EMBED_BITS : 1;
+    for (int ind = 0; ind < bits_count; ind++){
+        double& coef = dct_matrix[EMBED_POSITIONS.index[ind]];
+        double low = payload_bit(payload, ind) ? q / 4 + margin : margin;
+        double high = payload_bit(payload, ind) ? q - margin : q / 4 - margin;
+        double value = abs(coef), base = q * floor(value / q), best = INFINITY;
+        for (double cell = max(0.0, base - q); cell <= base + q; cell += q) { // интервалы соседних периодов
+            double inside = clamp(value, cell + low, cell + high);
+            if (abs(inside - value) < abs(best - value))
+                best = inside;
         }
-        if (i == 3) continue; // для обхода только нужных элементов для встраивания
-        cntj--;
+        coef = (coef < 0 ? -1 : 1) * best;
     }
-    return dct_matrix;
 }
 
-vector<vector<double>> generate_population(vector<vector<int>> original,vector<vector<int>> notorig, int population_size = 128,double beta = 0.9,int search_space = 10){
+template <class T, size_t Align>
+struct AlignedAllocator{
+    // Аллокатор для std::vector, выравнивающий буфер на Align байт
+    typedef T value_type;
+    template <class U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(Align))); }
+    void deallocate(T* ptr, size_t) noexcept { ::operator delete(ptr, align_val_t(Align)); }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+/*
+    Функции обновления особей метаэвристик над строками из n значений (обычно 64)
+    Случайные числа заранее записываются в буфер r через fill_uniform в том же порядке,
+    в котором их раньше выбирали поэлементно, поэтому сами функции не содержат ветвлений и вызовов генератора
+    Каждая операция над элементом такая же, как в скалярном варианте, поэтому результат совпадает побитово
+*/
+struct UpdateKernels{
+    // y += a * x
+    void (*axpy)(double a, const double* x, double* y, size_t n);
+    // ограничение значений отрезком [low, high]
+    void (*clamp)(double* x, size_t n, double low, double high);
+    // стадия учителя TLBO: out = current + r[2i] * (teacher - (1 + r[2i+1]) * mean)
+    void (*teacher)(const double* teacher, const double* mean, const double* current, const double* r, double* out, size_t n);
+    // стадия ученика TLBO: out = current + r * (better - worse)
+    void (*learner)(const double* better, const double* worse, const double* current, const double* r, double* out, size_t n);
+    // движение к цели (SCA, WOA): out = target - |C * target - agent| * A
+    void (*encircle)(const double* target, const double* agent, double A, double C, double* out, size_t n);
+    // спираль WOA: out = |target - agent| * e * c + target
+    void (*spiral)(const double* target, const double* agent, double e, double c, double* out, size_t n);
+    // сдвиг AOA: out = clamp(agent + shift, low, high)
+    void (*shift_clamp)(const double* agent, double shift, double low, double high, double* out, size_t n);
+};
+
+void axpy_scalar(double a, const double* x, double* y, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        y[i] += a * x[i];
+}
+
+void clamp_scalar(double* x, size_t n, double low, double high) {
+    for (size_t i = 0; i < n; i++)
+        x[i] = clamp(x[i], low, high);
+}
+
+void teacher_scalar(const double* teacher, const double* mean, const double* current, const double* r, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = r[2 * i] * (teacher[i] - (1.0 + r[2 * i + 1]) * mean[i]) + current[i];
+}
+
+void learner_scalar(const double* better, const double* worse, const double* current, const double* r, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = current[i] + r[i] * (better[i] - worse[i]);
+}
+
+void encircle_scalar(const double* target, const double* agent, double A, double C, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = target[i] - abs(C * target[i] - agent[i]) * A;
+}
+
+void spiral_scalar(const double* target, const double* agent, double e, double c, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = abs(target[i] - agent[i]) * e * c + target[i];
+}
+
+void shift_clamp_scalar(const double* agent, double shift, double low, double high, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = clamp(agent[i] + shift, low, high);
+}
+
+const UpdateKernels UPDATE_KERNELS_SCALAR{axpy_scalar, clamp_scalar, teacher_scalar, learner_scalar,
+                                          encircle_scalar, spiral_scalar, shift_clamp_scalar};
+
+#ifdef SIMD_X86_DISPATCH
+__attribute__((target("avx2")))
+inline __m256d abs_avx2(__m256d x) {
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+}
+
+__attribute__((target("avx2")))
+void axpy_avx2(double a, const double* x, double* y, size_t n) {
+    __m256d va = _mm256_set1_pd(a);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(va, _mm256_loadu_pd(x + i))));
+    axpy_scalar(a, x + i, y + i, n - i); // остаток, не поместившийся в регистр
+}
+
+__attribute__((target("avx2")))
+void clamp_avx2(double* x, size_t n, double low, double high) {
+    __m256d vlow = _mm256_set1_pd(low), vhigh = _mm256_set1_pd(high);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(x + i, _mm256_min_pd(_mm256_max_pd(_mm256_loadu_pd(x + i), vlow), vhigh));
+    clamp_scalar(x + i, n - i, low, high);
+}
+
+__attribute__((target("avx2")))
+void teacher_avx2(const double* teacher, const double* mean, const double* current, const double* r, double* out, size_t n) {
+    __m256d one = _mm256_set1_pd(1.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // разделение пар (r[2i], r[2i+1]) на два регистра
+        __m256d a = _mm256_loadu_pd(r + 2 * i), b = _mm256_loadu_pd(r + 2 * i + 4);
+        __m256d r1 = _mm256_permute4x64_pd(_mm256_unpacklo_pd(a, b), 0xD8);
+        __m256d r2 = _mm256_add_pd(one, _mm256_permute4x64_pd(_mm256_unpackhi_pd(a, b), 0xD8));
+        __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(teacher + i), _mm256_mul_pd(r2, _mm256_loadu_pd(mean + i)));
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(r1, diff), _mm256_loadu_pd(current + i)));
+    }
+    teacher_scalar(teacher + i, mean + i, current + i, r + 2 * i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void learner_avx2(const double* better, const double* worse, const double* current, const double* r, double* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(better + i), _mm256_loadu_pd(worse + i));
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(current + i), _mm256_mul_pd(_mm256_loadu_pd(r + i), diff)));
+    }
+    learner_scalar(better + i, worse + i, current + i, r + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void encircle_avx2(const double* target, const double* agent, double A, double C, double* out, size_t n) {
+    __m256d vA = _mm256_set1_pd(A), vC = _mm256_set1_pd(C);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d t = _mm256_loadu_pd(target + i);
+        __m256d d = abs_avx2(_mm256_sub_pd(_mm256_mul_pd(vC, t), _mm256_loadu_pd(agent + i)));
+        _mm256_storeu_pd(out + i, _mm256_sub_pd(t, _mm256_mul_pd(d, vA)));
+    }
+    encircle_scalar(target + i, agent + i, A, C, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void spiral_avx2(const double* target, const double* agent, double e, double c, double* out, size_t n) {
+    __m256d ve = _mm256_set1_pd(e), vc = _mm256_set1_pd(c);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d t = _mm256_loadu_pd(target + i);
+        __m256d d = abs_avx2(_mm256_sub_pd(t, _mm256_loadu_pd(agent + i)));
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(d, ve), vc), t));
+    }
+    spiral_scalar(target + i, agent + i, e, c, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void shift_clamp_avx2(const double* agent, double shift, double low, double high, double* out, size_t n) {
+    __m256d vshift = _mm256_set1_pd(shift), vlow = _mm256_set1_pd(low), vhigh = _mm256_set1_pd(high);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_add_pd(_mm256_loadu_pd(agent + i), vshift);
+        _mm256_storeu_pd(out + i, _mm256_min_pd(_mm256_max_pd(x, vlow), vhigh));
+    }
+    shift_clamp_scalar(agent + i, shift, low, high, out + i, n - i);
+}
+
+const UpdateKernels UPDATE_KERNELS_AVX2{axpy_avx2, clamp_avx2, teacher_avx2, learner_avx2,
+                                        encircle_avx2, spiral_avx2, shift_clamp_avx2};
+#endif
+
+const UpdateKernels& select_update_kernels() {
+    // Выбор самой быстрой реализации, которую поддерживает процессор
+#ifdef SIMD_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return UPDATE_KERNELS_AVX2;
+#endif
+    return UPDATE_KERNELS_SCALAR;
+}
+
+const UpdateKernels& UPDATE_KERNELS = select_update_kernels();
+
+inline void vec_axpy(double a, const double* x, double* y, size_t n) {
+    UPDATE_KERNELS.axpy(a, x, y, n);
+}
+
+inline void vec_clamp(double* x, size_t n, double low, double high) {
+    UPDATE_KERNELS.clamp(x, n, low, high);
+}
+
+class Population{
+    /*
+    *   Популяция метаэвристики: все особи в одном выровненном буфере, особь i - dimensions() значений подряд,
+        рядом хранятся значения метрики для каждой особи
+        Операции по столбцам (среднее) и над особями (clamp, axpy) идут по непрерывной памяти и векторизуются
+    */
+    private:
+    size_t count = 0;
+    size_t dims = 0;
+    vector<double, AlignedAllocator<double, 64>> values;
+    vector<double> fitness_values;
+
+    public:
+    Population() = default;
+    Population(size_t size, size_t dimensions) : count(size), dims(dimensions), values(size * dimensions), fitness_values(size) {}
+
+    size_t size() const { return count; }
+    size_t dimensions() const { return dims; }
+
+    double* operator[](size_t i) { return values.data() + i * dims; }
+    const double* operator[](size_t i) const { return values.data() + i * dims; }
+
+    double* fitness() { return fitness_values.data(); }
+    const double* fitness() const { return fitness_values.data(); }
+
+    void assign(size_t i, const double* agent) {
+        // Запись особи i
+        copy(agent, agent + dims, (*this)[i]);
+    }
+
+    vector<double> row(size_t i) const {
+        // Копия особи i
+        return vector<double>((*this)[i], (*this)[i] + dims);
+    }
+
+    void mean(double* out) const {
+        // Среднее по всем особям для каждого значения особи
+        fill(out, out + dims, 0.0);
+        for (size_t i = 0; i < count; i++) {
+            const double* agent = (*this)[i];
+            for (size_t j = 0; j < dims; j++)
+                out[j] += agent[j];
+        }
+        for (size_t j = 0; j < dims; j++)
+            out[j] /= count;
+    }
+
+    void clamp(size_t i, double low, double high) { vec_clamp((*this)[i], dims, low, high); }
+
+    void axpy(size_t i, double a, const double* x) { vec_axpy(a, x, (*this)[i], dims); }
+};
+
+Population generate_population(vector<vector<int>> original,vector<vector<int>> notorig, int population_size = 128,double beta = 0.9,int search_space = 10){
     /*
     *   Функция генерирует популяцию для работы метаэвристик
     *   На входе:
@@ -124,386 +1204,1061 @@ vector<vector<double>> generate_population(vector<vector<int>> original,vector<v
     *   Функция возвращает популяцию, которая состоит из заданного числа особей
     */
 
-    random_device rd;
-    mt19937 gen(rd());
-    double lower_bound = 0.0;
-    double upper_bound = 1.0;
-    uniform_real_distribution<double> uniform_dist(lower_bound, upper_bound);
-    uniform_int_distribution<int> search_dist(-search_space, search_space);
 
     // подсчитываем матрицу изменений
     vector<double> diff;
-    for (int i = 0; i < original.size(); i++)
-        for (int j = 0; j < original[0].size();j++)
+    for (size_t i = 0; i < original.size(); i++)
+        for (size_t j = 0; j < original[0].size(); j++)
             diff.push_back(original[i][j]-notorig[i][j]);
     
-    vector<vector<double>> population(population_size,vector<double>(diff.size()));
+    Population population(population_size, diff.size());
 
     // первая особь - начальная матрица изменений
-    for (int j = 0; j < diff.size(); j++)
+    for (size_t j = 0; j < diff.size(); j++)
         population[0][j] = diff[j];
 
     // генерируем популяцию c 0-го индекса,т.к. первая особь - начальная матрица изменений
+    vector<double> random_values(diff.size());
+    vector<int> random_search(diff.size());
     for (int i = 1; i < population_size; i++){
-        for (int j = 0; j < diff.size(); j++){
-            double random_value = uniform_dist(gen);
-            if (random_value > beta){ // если рандом больше вероятности, то заместо значения из матрицы изменений выбираем рандомное
-                int random_search = search_dist(gen); 
-                population[i][j] = random_search; 
+        fill_uniform(random_values.data(), diff.size(), 0.0, 1.0);
+        fill_uniform_int(random_search.data(), diff.size(), -search_space, search_space);
+        for (size_t j = 0; j < diff.size(); j++){
+            if (random_values[j] > beta){ // если рандом больше вероятности, то заместо значения из матрицы изменений выбираем рандомное
+                population[i][j] = random_search[j]; 
             }
             else{
                 population[i][j] = diff[j];
             }
         }
     }
-    return population;
-}
+    return population;
+}
+
+Population generate_population_dct(vector<vector<double>> original,vector<vector<double>> notorig, int population_size = 128,double beta = 0.9,int search_space = 10){
+    /*
+    *   Функция генерирует популяцию для работы метаэвристик
+    *   На входе:
+        original - блок изначального изображения
+        notorig - блок изображения после встраивание в его DCT-coef (поменялся из-за смены DCT-coef)
+        mode - выбранный тип работы, "A" - встроить 32 бита, иначе только 1 бит
+        population_size - размер популяции, сколько особей будет в ней
+        beta - с какой вероятностью берется значение разности между изначальным блоком и измененным (иначе берется рандом из пространства поиска)
+        search_space - пространство поиска, какому интервалу должны соотвествовать значения матрицы изменений
+    *   Функция возвращает популяцию, которая состоит из заданного числа особей
+    */
+
+
+    // подсчитываем матрицу изменений
+    vector<double> diff;
+    for (size_t i = 0; i < original.size(); i++)
+        for (size_t j = 0; j < original[0].size(); j++)
+            diff.push_back(original[i][j]-notorig[i][j]);
+
+    Population population(population_size, diff.size());
+
+    // первая особь - начальная матрица изменений
+    for (size_t j = 0; j < diff.size(); j++)
+        population[0][j] = diff[j];
+
+    // генерируем популяцию c 0-го индекса,т.к. первая особь - начальная матрица изменений
+    vector<double> random_values(diff.size());
+    vector<double> random_search(diff.size());
+    for (int i = 1; i < population_size; i++){
+        fill_uniform(random_values.data(), diff.size(), 0.0, 1.0);
+        fill_uniform(random_search.data(), diff.size(), -search_space, search_space);
+        for (size_t j = 0; j < diff.size(); j++){
+            if (random_values[j] > beta){ // если рандом больше вероятности, то заместо значения из матрицы изменений выбираем рандомное
+                population[i][j] = int(random_search[j]); // отбрасываем дробную часть, как и раньше
+            }
+            else{
+                population[i][j] = diff[j];
+            }
+        }
+    }
+    return population;
+}
+
+int extracting_dct(const Block& dct_block, uint32_t& bits, double q = 8.0){
+    /*
+    *   Функция реализует извлечение встроенной информации из блока DCT-coef
+    *   На входе:
+        dct_block - блок dct-коэффициентов, из которого необходимо извлечь информацию
+        bits - сюда записываются извлеченные биты (первый извлеченный бит - старший)
+        q - заданный шаг квантования еще при встраивании, такой же при извлечении
+    *   Функция возвращает количество извлеченных бит (1, если в блок информацию не встраивали)
+    */
+    bits = 0;
+    for (int ind = 0; ind < EMBED_BITS; ind++){
+        double coef = dct_block[EMBED_POSITIONS.index[ind]];
+        double c0 = sign(coef) * (q * int(abs(coef) / q) + (q/2) * (0));
+        double c1 = sign(coef) * (q * int(abs(coef) / q) + (q/2) * (1));
+        if (abs(coef - c0) < abs(coef - c1)){
+            if (ind == 0) // если 1ый выстроенный бит - 0, то в такой блок информацию не встроили
+                return 1; // возвращаем флаг, что информации в этом блоке нет
+        }
+        else
+            bits |= 1u << (EMBED_BITS - 1 - ind);
+    }
+
+    return EMBED_BITS;
+}
+
+int extracting_dct(const PixelBlock& pixel_block, uint32_t& bits, double q = 8.0){
+    // Извлечение информации из блока пикселей
+    Block dct_block;
+    dct_8x8(pixel_block, dct_block);
+    return extracting_dct(dct_block, bits, q);
+}
+
+class EvaluationCache{
+    /*
+    *   Кэш оценок особей одной метрики (одного блока)
+        Ключ - особь после квантования (в пространственной области - после отброса остатка) и шаг q,
+        значение - качество и преобразованная особь
+        Таблица прямого отображения фиксированного размера: запись со совпавшим слотом вытесняет старую,
+        поэтому после создания кэш не выделяет память
+        Потоки пула обращаются к кэшу одновременно, слоты защищены мьютексами (один на группу слотов)
+    */
+    private:
+    struct Entry{
+        bool valid = false;
+        int q = 0;
+        double fitness = 0;
+        Block key;
+        Block repaired;
+    };
+    static const size_t LOCKS = 16;
+
+    vector<Entry> entries;
+    size_t mask;
+    array<mutex, LOCKS> locks;
+    atomic<long long> lookup_count{0}, hit_count{0};
+
+    public:
+    explicit EvaluationCache(size_t capacity) {
+        // capacity округляется вверх до степени двойки
+        size_t size = LOCKS;
+        while (size < capacity)
+            size *= 2;
+        entries.resize(size);
+        mask = size - 1;
+    }
+
+    static uint64_t hash(const double* key, int q) {
+        uint64_t h = mix64(uint64_t(q));
+        for (int i = 0; i < BLOCK_AREA; i++) {
+            uint64_t bits;
+            memcpy(&bits, key + i, sizeof(bits));
+            h = mix64(h ^ bits);
+        }
+        return h;
+    }
+
+    bool find(uint64_t h, const double* key, int q, double& fitness, double* repaired) {
+        // Поиск особи key: при попадании записывает качество и преобразованную особь
+        lookup_count.fetch_add(1, memory_order_relaxed);
+        const Entry& entry = entries[h & mask];
+        lock_guard<mutex> lock(locks[h & (LOCKS - 1)]);
+        if (!entry.valid || entry.q != q || memcmp(entry.key.data(), key, sizeof(entry.key)) != 0)
+            return false;
+        fitness = entry.fitness;
+        copy(entry.repaired.begin(), entry.repaired.end(), repaired);
+        hit_count.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    void store(uint64_t h, const double* key, int q, double fitness, const double* repaired) {
+        Entry& entry = entries[h & mask];
+        lock_guard<mutex> lock(locks[h & (LOCKS - 1)]);
+        entry.valid = true;
+        entry.q = q;
+        entry.fitness = fitness;
+        copy(key, key + BLOCK_AREA, entry.key.begin());
+        copy(repaired, repaired + BLOCK_AREA, entry.repaired.begin());
+    }
+
+    long long lookups() const { return lookup_count.load(memory_order_relaxed); }
+    long long hits() const { return hit_count.load(memory_order_relaxed); }
+};
+
+struct CandidateState{
+    /*
+    *   Оцененная особь для инкрементальной оценки ее потомков (Metric::evaluate_delta):
+        пиксели сохраняемого блока, их DCT-coef и сумма квадратов отклонений от исходного блока
+    */
+    PixelBlock pixels;
+    Block dct;
+    int squared_error;
+};
+
+class Metric{
+    /*
+    *   Интерфейс оценки качества встраивания для особи
+        Реализация для конкретной области встраивания - DomainMetric,
+        метаэвристики работают через этот интерфейс
+    */
+    private:
+    mutable atomic<long long> evaluation_count{0}; // число оцененных особей
+
+    static long long& thread_evaluation_count() {
+        // Число особей, оценку которых запросил текущий поток (по всем метрикам)
+        thread_local long long count = 0;
+        return count;
+    }
+
+    void count_evaluations(long long count) const {
+        evaluation_count.fetch_add(count, memory_order_relaxed);
+        thread_evaluation_count() += count;
+        count_cost(&CostAccumulator::evaluations, count);
+    }
+
+    void evaluate_indices(Population& population, const size_t* indices, size_t count, int q) const {
+        /*
+            Оценка особей population[indices[t]] на потоках пула пакетами по EVALUATION_BATCH
+            Случайные числа особи i берутся из своего потока, ключ которого получен из одного числа генератора
+            вызывающего потока, поэтому результат не зависит ни от числа потоков, ни от деления на пакеты
+        */
+        uint64_t batch_key = thread_rng()();
+        count_evaluations(count);
+        CostAccumulator* cost = current_cost(); // затраты особей относятся к вызывающему
+        size_t batches = (count + EVALUATION_BATCH - 1) / EVALUATION_BATCH;
+        thread_pool().parallel_for(batches, [&](size_t b) {
+            CostScope cost_scope(cost);
+            size_t first = b * EVALUATION_BATCH;
+            evaluate_candidates(population, indices + first, min(EVALUATION_BATCH, count - first), batch_key, q);
+        });
+    }
+
+    protected:
+    unique_ptr<EvaluationCache> cache; // кэш оценок, nullptr - выключен
+    bool incremental_mode = false;
+    double screening_ratio = 1.0; // доля кандидатов, отправляемых на полную оценку (1 - без отсева)
+    mutable atomic<double> screening_threshold{0.0}; // порог предсказанного улучшения для одиночных кандидатов
+
+    // Особей в одном пакете evaluate_candidates (одна задача пула)
+    static constexpr size_t EVALUATION_BATCH = 16;
+
+    virtual double evaluate_candidate(const double* block, double* repaired, int q) const = 0;
+
+    virtual void evaluate_candidates(Population& population, const size_t* indices, size_t count, uint64_t batch_key, int q) const {
+        /*
+        *   Оценка особей population[indices[t]] с заменой их преобразованными (реализация может считать их пакетом)
+            Случайные числа особи i берутся из потока с ключом mix64(batch_key + i)
+        */
+        for (size_t t = 0; t < count; t++) {
+            size_t i = indices[t];
+            RandomStream candidate_stream(mix64(batch_key + i));
+            population.fitness()[i] = evaluate_candidate(population[i], population[i], q);
+        }
+    }
+    // Предсказание значения качества без преобразований блока (если метрика его умеет - predictable)
+    virtual bool predictable() const { return false; }
+    virtual double predict_candidate(const double*, int) const { return 0; }
+    virtual void candidate_state(const double* candidate, CandidateState& state) const = 0;
+    virtual double evaluate_delta_candidate(const double* parent, const CandidateState& parent_state, const double* block,
+                                            double* repaired, CandidateState& state, double accept_above, int q) const = 0;
 
-vector<vector<double>> generate_population_dct(vector<vector<double>> original,vector<vector<double>> notorig, int population_size = 128,double beta = 0.9,int search_space = 10){
-    /*
-    *   Функция генерирует популяцию для работы метаэвристик
-    *   На входе:
-        original - блок изначального изображения
-        notorig - блок изображения после встраивание в его DCT-coef (поменялся из-за смены DCT-coef)
-        mode - выбранный тип работы, "A" - встроить 32 бита, иначе только 1 бит
-        population_size - размер популяции, сколько особей будет в ней
-        beta - с какой вероятностью берется значение разности между изначальным блоком и измененным (иначе берется рандом из пространства поиска)
-        search_space - пространство поиска, какому интервалу должны соотвествовать значения матрицы изменений
-    *   Функция возвращает популяцию, которая состоит из заданного числа особей
-    */
+    public:
+    virtual ~Metric() = default;
 
-    random_device rd;
-    mt19937 gen(rd());
-    double lower_bound = 0.0;
-    double upper_bound = 1.0;
-    uniform_real_distribution<double> uniform_dist(lower_bound, upper_bound);
-    uniform_real_distribution<double> search_dist(-search_space, search_space);
+    void enable_cache(size_t entries) {
+        // Включение кэша оценок на entries записей: повторно встреченные особи не пересчитываются
+        cache = make_unique<EvaluationCache>(entries);
+    }
 
-    // подсчитываем матрицу изменений
-    vector<double> diff;
-    for (int i = 0; i < original.size(); i++)
-        for (int j = 0; j < original[0].size();j++)
-            diff.push_back(original[i][j]-notorig[i][j]);
+    const EvaluationCache* evaluation_cache() const { return cache.get(); }
 
-    vector<vector<double>> population(population_size,vector<double>(diff.size()));
+    void enable_incremental() {
+        // Включение инкрементальной оценки: метаэвристики, меняющие у особи немного значений, могут оценивать потомков через evaluate_delta
+        incremental_mode = true;
+    }
 
-    // первая особь - начальная матрица изменений
-    for (int j = 0; j < diff.size(); j++)
-        population[0][j] = diff[j];
+    bool incremental() const { return incremental_mode; }
 
-    // генерируем популяцию c 0-го индекса,т.к. первая особь - начальная матрица изменений
-    for (int i = 1; i < population_size; i++){
-        for (int j = 0; j < diff.size(); j++){
-            double random_value = uniform_dist(gen);
-            if (random_value > beta){ // если рандом больше вероятности, то заместо значения из матрицы изменений выбираем рандомное
-                int random_search = search_dist(gen);
-                population[i][j] = random_search;
-            }
-            else{
-                population[i][j] = diff[j];
-            }
-        }
+    void enable_screening(double ratio) {
+        /*
+            Включение отсева кандидатов по предсказанию метрики: из пакета кандидатов (evaluate_screened)
+            полностью оцениваются только доля ratio с наибольшим предсказанным улучшением,
+            одиночный кандидат (promising) - если предсказанное улучшение не меньше порога, который
+            подстраивается так, чтобы проходила та же доля
+        */
+        screening_ratio = ratio;
     }
-    return population;
-}
 
-vector<double> meanAlongAxis(const vector<vector<double>>& array) {
-    /*
-        Функция считает среднее по всем столбцам популяции
-        На входе - популяция
-        На выходе - вектор средних значения по столбцам
-    */
-    vector<double> meanValues(array[0].size(), 0.0);
+    bool screening() const { return screening_ratio < 1.0 && predictable(); }
 
-    for (int j = 0; j < array[0].size(); j++) {
-        double sum = 0.0;
-        for (int i = 0; i < array.size(); i++) {
-            sum += array[i][j];
-        }
-        meanValues[j] = sum / array.size();
+    double predict(const double* block, int q = 8) const { return predict_candidate(block, q); }
+
+    bool promising(const double* candidate, const double* parent, int q = 8) const {
+        /*
+        *   Стоит ли полностью оценивать кандидата, заменяющего особь parent (для последовательных метаэвристик)
+            Порог - оценка квантиля (1 - ratio) предсказанных улучшений, уточняемая после каждого кандидата;
+            острова ISLANDS уточняют общий порог одновременно, поэтому уточнение - цикл compare_exchange
+            (решение принимается по порогу, с которым уточнение прошло, ни одно уточнение не теряется)
+        */
+        if (!screening())
+            return true;
+        const double STEP = 1e-3;
+        double improvement = predict(candidate, q) - predict(parent, q);
+        double threshold = screening_threshold.load(memory_order_relaxed);
+        bool pass;
+        do
+            pass = improvement >= threshold;
+        while (!screening_threshold.compare_exchange_weak(
+            threshold, threshold + (pass ? STEP * (1.0 - screening_ratio) : -STEP * screening_ratio), memory_order_relaxed));
+        if (!pass)
+            count_cost(&CostAccumulator::screened);
+        return pass;
     }
 
-    return meanValues;
-}
+    void state(const double* candidate, CandidateState& state) const {
+        // Состояние уже преобразованной особи candidate, от которого считаются ее потомки
+        candidate_state(candidate, state);
+    }
 
-double getRandomInteger(int search_space) {
-    // Функция генерирует случайное целое число
-    random_device rd;
-    mt19937 rng(rd());
-    uniform_int_distribution<int> distribution(-search_space, search_space);
-    int randomInteger = distribution(rng);
-    return double(randomInteger);
-}
+    double evaluate_delta(const double* parent, const CandidateState& parent_state, const double* block, double* repaired,
+                          CandidateState& state, double accept_above = -INFINITY, int q = 8) const {
+        /*
+        *   Оценка особи block, отличающейся от преобразованной особи parent в немногих значениях
+            Блок пересчитывается от состояния родителя только по изменившимся значениям,
+            в state записывается состояние block. Результат совпадает с evaluate с точностью до погрешности
+            округления; если по инкрементальной оценке информация извлекается полностью и значение больше
+            accept_above (особь будет принята), особь проверяется полной оценкой
+        */
+        count_evaluations(1);
+        return evaluate_delta_candidate(parent, parent_state, block, repaired, state, accept_above, q);
+    }
 
-string extracting_dct(vector<vector<int>> pixel_block, double q = 8.0){
-    /*
-    *   Функция реализует извлечение встроенной информации из блока 
-    *   На входе:
-        pixel_block - блок изображения, из которого необходимо извлечь информацию
-        q - заданный шаг квантования еще при встраивании, такой же при извлечении
-    *   Функция возвращает строку - извлеченная информация
-    */
-    vector <vector<double>> dct_block = do_dct(pixel_block);
-    string s;
-    int cntj = 6;
-
-    for (int i = 0; i < dct_block.size(); i++){
-        for (int j = dct_block[0].size() - 1; j > cntj; j--){
-            double c0 = sign(dct_block[i][j]) * (q * int(abs(dct_block[i][j]) / q) + (q/2) * (0));
-            double c1 = sign(dct_block[i][j]) * (q * int(abs(dct_block[i][j]) / q) + (q/2) * (1));
-            if (abs(dct_block[i][j] - c0) < abs(dct_block[i][j] - c1)){
-                s += '0';
-                if (s == "0") // если 1ый выстроенный бит - 0, то в такой блок информацию не встроили
-                    return "0"; // возвращаем флаг, что информации в этом блоке нет
+    double evaluate(const double* block, double* repaired, int q = 8) const {
+        // Подсчет значения качества особи (см. evaluate_candidate у реализации)
+        count_evaluations(1);
+        return evaluate_candidate(block, repaired, q);
+    }
+
+    long long evaluations() const { return evaluation_count.load(memory_order_relaxed); }
+
+    // Оценки, запрошенные текущим потоком: у островов ISLANDS, оптимизирующих одну метрику, - свои
+    static long long thread_evaluations() { return thread_evaluation_count(); }
+
+    void evaluate_batch(Population& population, size_t begin, size_t end, int q = 8) const {
+        /*
+        *   Функция реализует параллельный подсчет значения качества для части популяции
+        *   На входе:
+            population - популяция, оцениваются особи с номерами [begin, end): особи заменяются
+            преобразованными, значения качества записываются в population.fitness()
+        *   Особи независимы, поэтому оцениваются на потоках пула пакетами (evaluate_candidates):
+            в частотной области DCT всех особей пакета считаются пакетными idct_8x8_batch / dct_8x8_batch
+        */
+        thread_local vector<size_t> indices;
+        indices.clear();
+        for (size_t i = begin; i < end; i++)
+            indices.push_back(i);
+        evaluate_indices(population, indices.data(), indices.size(), q);
+    }
+
+    void evaluate_screened(Population& candidates, const Population& parents, size_t begin, size_t end,
+                           size_t skip = SIZE_MAX, int q = 8) const {
+        /*
+        *   Оценка пакета кандидатов, каждый из которых заменит свою особь parents[i], если окажется лучше
+            При включенном отсеве полностью (как в evaluate_batch) оцениваются только доля screening_ratio
+            кандидатов с наибольшим предсказанным улучшением, остальным записывается значение -INFINITY
+            Кандидат с номером skip (например, место учителя TLBO) не оценивается, его значение -INFINITY
+        */
+        thread_local vector<size_t> indices;
+        indices.clear();
+        if (!screening()) {
+            for (size_t i = begin; i < end; i++) {
+                if (i != skip)
+                    indices.push_back(i);
+                else
+                    candidates.fitness()[i] = -INFINITY;
             }
-            else
-                s += '1';
+            evaluate_indices(candidates, indices.data(), indices.size(), q);
+            return;
         }
-        if (i == 3) continue; // для правильного обхода по элементам блока
-        cntj--;
+        thread_local vector<pair<double, size_t>> ranked;
+        ranked.clear();
+        for (size_t i = begin; i < end; i++) {
+            candidates.fitness()[i] = -INFINITY;
+            if (i != skip)
+                ranked.emplace_back(predict(candidates[i], q) - predict(parents[i], q), i);
+        }
+        if (ranked.empty())
+            return;
+        // хотя бы один кандидат оценивается полностью (в том числе при screening_ratio <= 0)
+        size_t selected = clamp(size_t(ceil(max(screening_ratio, 0.0) * ranked.size())), size_t(1), ranked.size());
+        nth_element(ranked.begin(), ranked.begin() + selected - 1, ranked.end(), greater<pair<double, size_t>>());
+        count_cost(&CostAccumulator::screened, ranked.size() - selected);
+        for (size_t t = 0; t < selected; t++)
+            indices.push_back(ranked[t].second);
+        evaluate_indices(candidates, indices.data(), selected, q);
     }
 
-    return s;
-}
+    pair<double, vector<double>> metric(const vector<double>& block, int q = 8) const {
+        /*
+        *   Функция реализует подсчет значения качества для данного блока
+        *   Функция возвращает пару - значение качества и преобразованную особь
+        */
+        vector<double> repaired(BLOCK_AREA);
+        double fitness = evaluate(block.data(), repaired.data(), q);
+        return make_pair(fitness, repaired);
+    }
+};
 
-class Metric{
+// Области встраивания: особь - изменения пикселей блока или изменения его DCT-coef
+struct SpatialDomain{
+    static constexpr bool frequency = false;
+};
+
+struct FrequencyDomain{
+    static constexpr bool frequency = true;
+};
+
+// Больше изменившихся значений особи (или пикселей блока) пересчитывать по одному дороже, чем преобразовать весь блок
+const int INCREMENTAL_CHANGES = 16;
+
+template <class Domain>
+class DomainMetric : public Metric{
     /*
-    *   Класс оценки качества встраивания для данной особи
+    *   Класс оценки качества встраивания для данной особи в области Domain
+        Область выбирается при компиляции, поэтому в подсчете метрики нет проверок метода встраивания
         Задается параметрами:
         block_matrix - блок из начальной картинки
-        bit_string - строка, которую собираемся встраивать
+        payload - 32 бита, которые собираемся встраивать (в режиме 'Z' встраивается только старший бит-флаг)
         search_space - пространство поиска, дальше которого значения особи выходить не могут
         mode - встраиваем 1 или несколько бит
     */
     private:
-    vector<vector<int>> block_matrix;
-    string bit_string;
+    PixelBlock block_matrix;
+    Block dct_matrix; // DCT-coef исходного блока, считаются один раз при создании метрики
+    double psnr_reference; // числитель psnr: 64 * 255^2
+    uint32_t payload;
     int search_space;
     char mode;
-    string method;
 
     public: 
-    Metric(const vector<vector<int>>& block_matrix, const string& bit_string, const int& search_space, const char& mode,const string method)
-        : block_matrix(block_matrix), bit_string(bit_string), search_space(search_space), mode(mode) , method(method){}
-
-    pair<double, vector<double>> metric(const vector<double>& block, int q = 8) {
-        /*
-        *   Функция реализует подсчет значения качества для данного блока
-        *   На входе:
-            block - особь популяции, которая нуждается в проверке качества
-            q - заданный шаг квантования еще при встраивании, такой же при извлечении
-        *   Функция возвращает пару - преобразованную особь и значение качества для нее
-        */
+    DomainMetric(const vector<vector<int>>& block_matrix, uint32_t payload, int search_space, char mode)
+        : block_matrix(flatten_block(block_matrix)), payload(payload), search_space(search_space), mode(mode) {
+        dct_8x8(this->block_matrix, dct_matrix);
+        psnr_reference = pow(8,2) * pow(255,2);
+    }
 
-        // New_block - блок после добавлениня к нему матрицы изменений
+    private:
+    bool quantize(const double* block, Block& block_flatten) const {
         // block_flatten - особь, у которой отбросили остаток и проверили на выход за пространство поиска
-        vector<vector<int>> new_block = block_matrix;
-        vector<double> block_flatten = block;
-        vector<vector<double>> dct_coef_block;
-
-        for (int i = 0; i < block_flatten.size(); i++){
-            if (method == "spatial")
+        // Возвращает true, если какое-то значение пришлось заменить случайным
+        bool random_repair = false;
+        for (int i = 0; i < BLOCK_AREA; i++){
+            block_flatten[i] = block[i];
+            if constexpr (!Domain::frequency)
                 block_flatten[i] = floor(block_flatten[i]); // отброс остатка у особи
 
-            if ((block_flatten[i] < -search_space) || (block_flatten[i] > search_space))
+            if ((block_flatten[i] < -search_space) || (block_flatten[i] > search_space)) {
                 block_flatten[i] = getRandomInteger(search_space); // если значение в особи вышло за пространство - генерируем вместо него новое
+                random_repair = true;
+            }
         }
+        return random_repair;
+    }
 
-        if (method == "frequency"){
-            dct_coef_block = do_dct(block_matrix);
-            vector<vector<double>> dct_coef_block1 = dct_coef_block;
-            int ind_fl = 0;
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    dct_coef_block1[i][j] -= block_flatten[ind_fl];
-                    ind_fl++;
-                }
-            }
-            new_block = undo_dct(dct_coef_block1);
-        }
-        //ind_f1 - индекс, идущий поэлементно в осооби
-        int ind_fl = 0;
-        for (int i = 0; i < 8; i++){
-            for (int j = 0; j < 8; j++){
-                if (method == "spatial") {
-                    new_block[i][j] -= block_flatten[ind_fl];
-                    if (new_block[i][j] > 255) { // выход за предел 255 в изображении, увеличиваем значение особи на разность выхода и 255
-                        int diff = abs(new_block[i][j] - 255);
-                        block_flatten[ind_fl] += diff;
-                        new_block[i][j] = 255;
-                    }
-                    if (new_block[i][j] < 0) { // выход за предел 0, уменьшаем значение особи на значение выхода по модулю
-                        int diff = abs(new_block[i][j]);
-                        block_flatten[ind_fl] -= diff;
-                        new_block[i][j] = 0;
-                    }
-                    ind_fl++;
-                }
-                else{
-                    if (new_block[i][j] > 255)
-                        new_block[i][j] = 255;
-                    if (new_block[i][j] < 0)
-                        new_block[i][j] = 0;
-                }
-            }
+    void spatial_pixel(int ind_fl, Block& block_flatten, PixelBlock& new_block) const {
+        // Пиксель ind_fl блока после добавления к нему матрицы изменений (пространственная область)
+        new_block[ind_fl] = block_matrix[ind_fl];
+        new_block[ind_fl] -= block_flatten[ind_fl];
+        if (new_block[ind_fl] > 255) { // выход за предел 255 в изображении, увеличиваем значение особи на разность выхода и 255
+            int diff = abs(new_block[ind_fl] - 255);
+            block_flatten[ind_fl] += diff;
+            new_block[ind_fl] = 255;
         }
-        vector<vector<double>> dct_block_ret;
-        // считаем метрику качества psnr
-        if (method == "frequency") {
-            dct_block_ret = do_dct(new_block);
+        if (new_block[ind_fl] < 0) { // выход за предел 0, уменьшаем значение особи на значение выхода по модулю
+            int diff = abs(new_block[ind_fl]);
+            block_flatten[ind_fl] -= diff;
+            new_block[ind_fl] = 0;
+        }
+    }
 
-            new_block = undo_dct(dct_block_ret);
+    void block_pixels(Block& block_flatten, PixelBlock& new_block) const {
+        // New_block - блок после добавлениня к нему матрицы изменений
+        if constexpr (Domain::frequency){
+            Block dct_coef_block;
+            for (int i = 0; i < BLOCK_AREA; i++)
+                dct_coef_block[i] = dct_matrix[i] - block_flatten[i];
+            idct_8x8(dct_coef_block, new_block);
+            for (int ind_fl = 0; ind_fl < BLOCK_AREA; ind_fl++){
+                if (new_block[ind_fl] > 255)
+                    new_block[ind_fl] = 255;
+                if (new_block[ind_fl] < 0)
+                    new_block[ind_fl] = 0;
+            }
         }
+        else
+            for (int ind_fl = 0; ind_fl < BLOCK_AREA; ind_fl++)
+                spatial_pixel(ind_fl, block_flatten, new_block);
+    }
+
+    int squared_error(const PixelBlock& new_block) const {
         int sum_elem = 0;
-        for (int i = 0; i < 8; i++)
-            for (int j = 0; j < 8; j++)
-                sum_elem += pow(block_matrix[i][j] - new_block[i][j],2);
+        for (int i = 0; i < BLOCK_AREA; i++)
+            sum_elem += (block_matrix[i] - new_block[i]) * (block_matrix[i] - new_block[i]);
+        return sum_elem;
+    }
+
+    double score(Block& block_flatten, const Block& dct_block_ret, int sum_elem, double* repaired, int q, bool* perfect = nullptr) const {
+        /*
+        *   Значение качества по сохраняемому блоку: dct_block_ret - его DCT-coef, sum_elem - сумма квадратов отклонений от исходного
+            В repaired записывается преобразованная особь, perfect - извлекается ли вся порция
+        */
+        // считаем метрику качества psnr
         double psnr = 0;
         if (sum_elem != 0)
-            psnr = 10 * log10((pow(8,2) * pow(255,2)) / double(sum_elem));
+            psnr = 10 * log10(psnr_reference / double(sum_elem));
         else
             psnr = 42;
 
-        string s;
-        s = extracting_dct(new_block);
+        uint32_t extracted;
+        int length = extracting_dct(dct_block_ret, extracted, q);
         int cnt = 0;
-        if (s[0] == bit_string[0]){ // несовпадение первого извлеченного бита - нет смысла дальше проверять, возвращаем 0
-        // подсчитываем кол-во бит, извлеченных правильно
-        for (int i = 0; i < s.length(); i++)
-            if (s[i] == bit_string[i])
-                cnt += 1;
-        }
+        if (payload_bit(extracted, 0) == payload_bit(payload, 0)) // несовпадение первого извлеченного бита - нет смысла дальше проверять, возвращаем 0
+            cnt = length - popcount32((extracted ^ payload) & payload_mask(length)); // подсчитываем кол-во бит, извлеченных правильно
+        if (perfect)
+            *perfect = cnt == length;
+
+        if constexpr (Domain::frequency) // особь в частотной области - разность DCT-coef исходного и сохраняемого блоков
+            for (int i = 0; i < BLOCK_AREA; i++)
+                block_flatten[i] = dct_matrix[i] - dct_block_ret[i];
+        copy(block_flatten.begin(), block_flatten.end(), repaired);
 
-        pair<double, vector<double>> to_ret;
         //выводим в кач-ве метрики сумму psnr*10^-4 + ber
-        if (method == "spatial")
-            to_ret = make_pair(psnr/10000 + double(cnt)/double(s.length()), block_flatten);
-        else{
-            dct_coef_block = do_dct(block_matrix);
-            vector<double> to_ret_1d_dct;
-            for (int i = 0; i < 8; i++)
-                for (int j = 0; j < 8; j++)
-                    to_ret_1d_dct.push_back(dct_coef_block[i][j] - dct_block_ret[i][j]);
-
-            int ind_fl = 0;
-            for (int i10 = 0; i10 < 8; i10++) {
-                for (int j10 = 0; j10 < 8; j10++) {
-                    dct_coef_block[i10][j10] -= to_ret_1d_dct[ind_fl];
-                    ind_fl++;
-                }
+        return psnr/10000 + double(cnt)/double(length);
+    }
+
+    double evaluate_full(Block& block_flatten, double* repaired, int q, CandidateState* state = nullptr) const {
+        // Полная оценка квантованной особи, в state (если задан) записывается ее состояние
+        PixelBlock pixels;
+        Block dct;
+        PixelBlock& new_block = state ? state->pixels : pixels;
+        // DCT-coef блока, который будет сохранен в изображение
+        Block& dct_block_ret = state ? state->dct : dct;
+        block_pixels(block_flatten, new_block);
+        dct_8x8(new_block, dct_block_ret);
+        int sum_elem = squared_error(new_block);
+        if (state)
+            state->squared_error = sum_elem;
+        return score(block_flatten, dct_block_ret, sum_elem, repaired, q);
+    }
+
+    static double bit0_measure(double a, double q) {
+        // Мера точек [0, a], у которых остаток по модулю q меньше q/4 (извлекается бит 0)
+        double periods = floor(a / q);
+        return periods * (q / 4) + min(a - periods * q, q / 4);
+    }
+
+    static double bit0_probability(double coef, double q) {
+        // Вероятность извлечь бит 0 из DCT-coef, равномерно размытого на +-0.5 округлением пикселей
+        double lo = coef - 0.5, hi = coef + 0.5;
+        if (lo >= 0)
+            return bit0_measure(hi, q) - bit0_measure(lo, q);
+        if (hi <= 0)
+            return bit0_measure(-lo, q) - bit0_measure(-hi, q);
+        return bit0_measure(hi, q) + bit0_measure(-lo, q);
+    }
+
+    protected:
+    bool predictable() const override { return Domain::frequency; }
+
+    double predict_candidate(const double* block, int q) const override {
+        /*
+        *   Предсказание значения качества особи в частотной области без обратного и прямого DCT
+            DCT-coef сохраняемого блока предсказываются как dct исходного блока - особь, округление пикселей
+            считается равномерным шумом +-0.5 в каждом коэффициенте, выход пикселей за [0, 255] не учитывается
+            Сумма квадратов отклонений по равенству Парсеваля - сумма квадратов особи + шум округления (64/12)
+            Вместо доли правильно извлеченных бит - ее ожидание по вероятностям извлечения каждого бита
+        */
+        double energy = BLOCK_AREA / 12.0;
+        for (int i = 0; i < BLOCK_AREA; i++) {
+            double value = clamp(block[i], double(-search_space), double(search_space));
+            energy += value * value;
+        }
+        double psnr = min(42.0, 10 * log10(psnr_reference / energy));
+
+        double correct[EMBED_BITS];
+        for (int ind = 0; ind < EMBED_BITS; ind++) {
+            int pos = EMBED_POSITIONS.index[ind];
+            double coef = dct_matrix[pos] - clamp(block[pos], double(-search_space), double(search_space));
+            double p0 = bit0_probability(coef, q);
+            correct[ind] = payload_bit(payload, ind) ? 1 - p0 : p0;
+        }
+        if (!payload_bit(payload, 0)) // порция из одного бита-флага
+            return psnr/10000 + correct[0];
+        double expected = 0;
+        for (int ind = 0; ind < EMBED_BITS; ind++)
+            expected += correct[ind];
+        return psnr/10000 + correct[0] * expected / EMBED_BITS;
+    }
+
+    double evaluate_candidate(const double* block, double* repaired, int q) const override {
+        /*
+        *   Функция реализует подсчет значения качества для данной особи без выделения памяти
+        *   На входе:
+            block - особь популяции (64 значения), которая нуждается в проверке качества
+            repaired - буфер на 64 значения, куда записывается преобразованная особь (может совпадать с block)
+            q - заданный шаг квантования еще при встраивании, такой же при извлечении
+        *   Функция возвращает значение качества особи
+        *   В частотной области на одну особь тратится одно обратное и одно прямое DCT:
+            пиксели = округление(idct(dct исходного блока - особь)), затем dct(пиксели) -
+            это ровно те коэффициенты, которые получит извлечение из сохраненного изображения
+        */
+        Block block_flatten;
+        bool random_repair = quantize(block, block_flatten);
+
+        // дальше оценка зависит только от квантованной особи, поэтому ее можно взять из кэша;
+        // особи со случайно замененными значениями не кэшируются
+        uint64_t key_hash = 0;
+        Block key;
+        bool cached = cache && !random_repair;
+        if (cached) {
+            key = block_flatten;
+            key_hash = EvaluationCache::hash(key.data(), q);
+            double fitness;
+            if (cache->find(key_hash, key.data(), q, fitness, repaired)) {
+                count_cost(&CostAccumulator::cache_hits);
+                return fitness;
             }
-            if (cnt == s.length()){
-                string new_s = extracting_dct(undo_dct(dct_coef_block));
-                if (new_s != s){
-                    cnt = 0;
-                   // cout << new_s << ' ' << s;
-                }
+        }
+
+        double fitness = evaluate_full(block_flatten, repaired, q);
+        if (cached)
+            cache->store(key_hash, key.data(), q, fitness, repaired);
+        return fitness;
+    }
+
+    void evaluate_candidates(Population& population, const size_t* indices, size_t count, uint64_t batch_key, int q) const override {
+        /*
+        *   Пакетная оценка особей population[indices[t]] (не больше EVALUATION_BATCH): особи квантуются и ищутся
+            в кэше по одной, а DCT всех остальных считаются за один проход пакетными преобразованиями
+            в формате structure-of-arrays - в частотной области idct_8x8_batch, затем dct_8x8_batch
+            Результат побитово совпадает с оценкой по одной (evaluate_candidate)
+        */
+        thread_local vector<Block> keys, flattened; // квантованные особи: ключи кэша и рабочие копии
+        thread_local vector<char> cacheable;
+        thread_local vector<size_t> pending; // номера в пакете особей, не найденных в кэше
+        thread_local vector<PixelBlock> pixels;
+        thread_local vector<double> soa;
+        keys.resize(count);
+        flattened.resize(count);
+        cacheable.resize(count);
+        pixels.resize(count);
+        soa.resize(BLOCK_AREA * count);
+        pending.clear();
+        double* fitness = population.fitness();
+
+        for (size_t t = 0; t < count; t++) {
+            size_t i = indices[t];
+            RandomStream candidate_stream(mix64(batch_key + i));
+            bool random_repair = quantize(population[i], keys[t]);
+            cacheable[t] = cache && !random_repair; // особи со случайно замененными значениями не кэшируются
+            if (cacheable[t] && cache->find(EvaluationCache::hash(keys[t].data(), q), keys[t].data(), q, fitness[i], population[i])) {
+                count_cost(&CostAccumulator::cache_hits);
+                continue;
             }
-            to_ret = make_pair(psnr/10000 + double(cnt)/double(s.length()), to_ret_1d_dct);
+            flattened[t] = keys[t];
+            pending.push_back(t);
+        }
+        size_t n = pending.size();
+        if (n == 0)
+            return;
+
+        // пиксели сохраняемых блоков
+        if constexpr (Domain::frequency){
+            for (size_t p = 0; p < n; p++)
+                for (int e = 0; e < BLOCK_AREA; e++)
+                    soa[e * n + p] = dct_matrix[e] - flattened[pending[p]][e];
+            idct_8x8_batch(soa.data(), soa.data(), n);
+            for (size_t p = 0; p < n; p++)
+                for (int e = 0; e < BLOCK_AREA; e++)
+                    pixels[p][e] = clamp(static_cast<int>(floor(soa[e * n + p] + 0.5)), 0, 255);
+        }
+        else
+            for (size_t p = 0; p < n; p++)
+                for (int e = 0; e < BLOCK_AREA; e++)
+                    spatial_pixel(e, flattened[pending[p]], pixels[p]);
+
+        // DCT-coef сохраняемых блоков и значения качества
+        for (size_t p = 0; p < n; p++)
+            for (int e = 0; e < BLOCK_AREA; e++)
+                soa[e * n + p] = static_cast<double>(pixels[p][e]);
+        dct_8x8_batch(soa.data(), soa.data(), n);
+        for (size_t p = 0; p < n; p++) {
+            size_t t = pending[p], i = indices[t];
+            Block dct_block_ret;
+            block_from_soa(soa.data(), n, p, dct_block_ret.data());
+            fitness[i] = score(flattened[t], dct_block_ret, squared_error(pixels[p]), population[i], q);
+            if (cacheable[t])
+                cache->store(EvaluationCache::hash(keys[t].data(), q), keys[t].data(), q, fitness[i], population[i]);
         }
-        return to_ret;
     }
-};
 
+    void candidate_state(const double* candidate, CandidateState& state) const override {
+        Block block_flatten;
+        for (int i = 0; i < BLOCK_AREA; i++)
+            block_flatten[i] = Domain::frequency ? candidate[i] : floor(candidate[i]);
+        block_pixels(block_flatten, state.pixels);
+        dct_8x8(state.pixels, state.dct);
+        state.squared_error = squared_error(state.pixels);
+    }
+
+    double evaluate_delta_candidate(const double* parent, const CandidateState& parent_state, const double* block,
+                                    double* repaired, CandidateState& state, double accept_above, int q) const override {
+        /*
+        *   Инкрементальная оценка особи block от преобразованной особи parent
+            Каждое изменившееся значение особи меняет блок на одну двумерную базисную функцию (64 умножения
+            вместо разделимого преобразования всего блока), так же DCT-coef пересчитываются по изменившимся пикселям,
+            а сумма квадратов отклонений - только по ним
+            Если изменений больше INCREMENTAL_CHANGES или значения пришлось заменять случайными, делается полная оценка
+        */
+        Block block_flatten;
+        if (quantize(block, block_flatten))
+            return evaluate_full(block_flatten, repaired, q, &state);
+
+        int changed[BLOCK_AREA];
+        int num_changed = 0;
+        for (int i = 0; i < BLOCK_AREA; i++)
+            if (block_flatten[i] != parent[i])
+                changed[num_changed++] = i;
+        if (num_changed > INCREMENTAL_CHANGES)
+            return evaluate_full(block_flatten, repaired, q, &state);
+        Block quantized = block_flatten; // для проверки полной оценкой
+
+        PixelBlock& new_block = state.pixels;
+        if constexpr (Domain::frequency){
+            // пиксели родителя = idct(dct исходного блока - parent), поэтому пиксели особи = пиксели родителя + idct(parent - особь)
+            Block pixels;
+            for (int p = 0; p < BLOCK_AREA; p++)
+                pixels[p] = parent_state.pixels[p];
+            for (int c = 0; c < num_changed; c++)
+                vec_axpy(parent[changed[c]] - block_flatten[changed[c]], DCT_BASIS.coef_to_pixel[changed[c]], pixels.data(), BLOCK_AREA);
+            for (int p = 0; p < BLOCK_AREA; p++)
+                new_block[p] = clamp(static_cast<int>(floor(pixels[p] + 0.5)), 0, 255);
+        }
+        else{
+            new_block = parent_state.pixels;
+            for (int c = 0; c < num_changed; c++)
+                spatial_pixel(changed[c], block_flatten, new_block);
+        }
 
-vector<double> getRandomArray(size_t size, double low, double high) {
-    // Функция генерирует рандомный вектор, состоящий из нецелых чисел
-    vector<double> randomArray;
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_real_distribution<double> distribution(low, high);
+        // DCT-coef и сумма квадратов отклонений - по изменившимся пикселям
+        int changed_pixels = 0;
+        state.squared_error = parent_state.squared_error;
+        for (int p = 0; p < BLOCK_AREA; p++)
+            if (new_block[p] != parent_state.pixels[p]) {
+                changed[changed_pixels++] = p;
+                state.squared_error += (block_matrix[p] - new_block[p]) * (block_matrix[p] - new_block[p])
+                                     - (block_matrix[p] - parent_state.pixels[p]) * (block_matrix[p] - parent_state.pixels[p]);
+            }
+        if (changed_pixels > INCREMENTAL_CHANGES)
+            dct_8x8(new_block, state.dct);
+        else{
+            state.dct = parent_state.dct;
+            for (int c = 0; c < changed_pixels; c++)
+                vec_axpy(new_block[changed[c]] - parent_state.pixels[changed[c]], DCT_BASIS.pixel_to_coef[changed[c]],
+                         state.dct.data(), BLOCK_AREA);
+        }
+        count_cost(&CostAccumulator::incremental);
 
-    for (size_t i = 0; i < size; i++) {
-        randomArray.push_back(distribution(gen));
+        bool perfect;
+        double fitness = score(block_flatten, state.dct, state.squared_error, repaired, q, &perfect);
+        if (perfect && fitness > accept_above) // погрешность округления могла исказить извлечение, поэтому принимаемая полная порция
+            return evaluate_full(quantized, repaired, q, &state); // подтверждается полной оценкой
+        return fitness;
     }
+};
 
-    return randomArray;
+// Создание метрики для блока в выбранной области встраивания
+typedef unique_ptr<Metric> (*MetricFactory)(const vector<vector<int>>& block_matrix, uint32_t payload, int search_space, char mode);
+
+template <class Domain>
+unique_ptr<Metric> make_domain_metric(const vector<vector<int>>& block_matrix, uint32_t payload, int search_space, char mode) {
+    return make_unique<DomainMetric<Domain>>(block_matrix, payload, search_space, mode);
 }
 
-vector<double> calculateDifference(const vector<double>& teacher, const vector<double>& population_mean) {
-    // Функция подсчитывает разность между лучшей особью(учитель) и средним для популяции (метаэвристика TLBO)
-    size_t num_features = teacher.size();
-    vector<double> difference;
-    
-    vector<double> randomUniform1 = getRandomArray(num_features, 0.0, 1.0);
-    vector<double> randomUniform2 = getRandomArray(num_features, 1.0, 2.0);
-    
-    for (size_t i = 0; i < num_features; i++) {
-        difference.push_back(randomUniform1[i] * (teacher[i] - randomUniform2[i] * population_mean[i]));
-    }
+MetricFactory find_metric(const string& method) {
+    // Выбор области встраивания по названию метода ("spatial" или "frequency")
+    if (method == "spatial")
+        return make_domain_metric<SpatialDomain>;
+    if (method == "frequency")
+        return make_domain_metric<FrequencyDomain>;
+    throw invalid_argument("unknown method: " + method);
+}
+
+
+/*
+    Функции обновления особей ниже записывают результат в заранее выделенный буфер new_position
+    (размером с особь num_features), чтобы во внутренних циклах метаэвристик не было выделений памяти
+*/
+
+void calculateDifference(const double* teacher, const double* population_mean, const double* current, double* random,
+                         double* student, size_t num_features) {
+    /*
+        Стадия учителя (метаэвристика TLBO): ученик сдвигается на разность между лучшей особью (учитель)
+        и средним для популяции
+        random - буфер на 2 * num_features случайных чисел
+    */
+    fill_uniform(random, 2 * num_features, 0.0, 1.0);
+    UPDATE_KERNELS.teacher(teacher, population_mean, current, random, student, num_features);
+}
 
-    return difference;
+void calculateDifferenceRand(const double* rand1, const double* rand2, const double* population_cur, double* random,
+                             double* new_population, size_t num_features) {
+    // Подсчет разности для рандомных особей (метаэвристика TLBO), random - буфер на num_features случайных чисел
+    fill_uniform(random, num_features, 0.0, 1.0);
+    UPDATE_KERNELS.learner(rand1, rand2, population_cur, random, new_population, num_features);
 }
 
-vector<double> calculateDifferenceRand(const vector<double>& rand1,const vector<double>& rand2, const vector<double>& population_cur) {
-    // Подсчет разности для рандомных особей (метаэвристика TLBO)
-    size_t num_features = population_cur.size();
-    vector<double> new_population;
-    
-    vector<double> randomUniform1 = getRandomArray(num_features, 0.0, 1.0);
-    
-    for (size_t i = 0; i < num_features; i++) {
-        new_population.push_back(population_cur[i] + randomUniform1[i] * (rand1[i] - rand2[i]));
-    }
+void calculateDifferenceSCA(const double* random_agent, const double* agent, const double A, const double C, double* new_position, size_t num_features) {
+    // Новая позиция агента относительно случайного агента (метаэвристика SCA)
+    UPDATE_KERNELS.encircle(random_agent, agent, A, C, new_position, num_features);
+}
 
-    return new_population;
+void updatePosition(const double* agent, double t, pair<double,double> search, double* new_position, size_t num_features) {
+    // Сдвиг агента на одну и ту же величину по всем значениям с ограничением пространством поиска (метаэвристика AOA)
+    double amplitude = (search.second - search.first) / 2.0;
+    UPDATE_KERNELS.shift_clamp(agent, amplitude * sin(2 * M_PI * t), search.first, search.second, new_position, num_features);
 }
 
-vector<double> calculateDifferenceSCA(const vector<double>& random_agent,const vector<double>& agent, const double C) {
-    // Подсчет разности между агентами в популяции (метаэвристика SCA)
-    size_t num_features = agent.size();
-    vector<double> D;
-        
-    for (size_t i = 0; i < num_features; i++) {
-        D.push_back(abs(C * random_agent[i] - agent[i]));
+struct StopCriteria{
+    /*
+    *   Условия досрочной остановки метаэвристики (проверяются после каждого поколения)
+        Значение 0 (или бесконечность для target_fitness) отключает условие
+    */
+    double target_fitness = INFINITY; // лучшее значение метрики превысило target_fitness
+    int stagnation_generations = 0; // лучшее значение не улучшалось столько поколений
+    int plateau_generations = 0; // информация встроена идеально, но psnr за столько поколений вырос меньше,
+    double plateau_psnr = 0; // чем на plateau_psnr дБ
+    double time_limit_ms = 0; // ограничение времени на одну оптимизацию
+    long long max_evaluations = 0; // ограничение числа оценок особей
+};
+
+struct StopReport{
+    /*
+    *   Итог оптимизации: сколько поколений и оценок особей потрачено, сколько сэкономлено
+    */
+    int generations = 0;
+    long long evaluations = 0;
+    long long evaluations_saved = 0; // оценки, которые потратили бы оставшиеся поколения
+    const char* reason = "budget"; // какое условие остановило оптимизацию
+    string winner; // метаэвристика портфеля (PORTFOLIO), давшая результат
+};
+
+class StopPolicy{
+    /*
+    *   Проверка условий остановки для одного запуска метаэвристики
+        Создается после оценки начальной популяции, should_stop вызывается в конце каждого поколения
+        Оценки считаются по потоку, выполняющему метаэвристику (Metric::thread_evaluations), поэтому
+        острова ISLANDS и соперники PORTFOLIO с общей метрикой не расходуют max_evaluations друг друга
+    */
+    private:
+    StopCriteria criteria;
+    int num_iterations;
+    long long start_evaluations; // оценки до начала поколений (начальная популяция)
+    chrono::steady_clock::time_point start_time;
+    int generation = 0;
+    double best = -INFINITY;
+    int best_generation = 0; // поколение последнего улучшения
+    double plateau_fitness = -INFINITY; // значение метрики в начале текущего плато
+    int plateau_generation = 0;
+    const char* reason = "budget";
+
+    public:
+    StopPolicy(const StopCriteria& criteria, int num_iterations)
+        : criteria(criteria), num_iterations(num_iterations),
+          start_evaluations(Metric::thread_evaluations()), start_time(chrono::steady_clock::now()) {
     }
 
-    return D;
-}
+    bool should_stop(double best_fitness) {
+        // best_fitness - лучшее значение метрики после очередного поколения
+        generation++;
+        if (best_fitness > best) {
+            best = best_fitness;
+            best_generation = generation;
+        }
+        if (best <= 1 || best - plateau_fitness >= criteria.plateau_psnr / 10000) { // psnr входит в метрику как psnr/10000
+            plateau_fitness = best;
+            plateau_generation = generation;
+        }
 
-vector<double> calculateDifferenceRandomPositonSCA(const vector<double>& random_agent,const vector<double>& D, const double A) {
-    // Подсчет разности для рандомных позиций (метаэвристика SCA)
-    size_t num_features = D.size();
-    vector<double> new_position;
-        
-    for (size_t i = 0; i < num_features; i++) {
-        new_position.push_back(random_agent[i] - D[i]*A);
+        if (best > criteria.target_fitness)
+            reason = "target";
+        else if (criteria.stagnation_generations && generation - best_generation >= criteria.stagnation_generations)
+            reason = "stagnation";
+        else if (criteria.plateau_generations && generation - plateau_generation >= criteria.plateau_generations)
+            reason = "plateau";
+        else if (criteria.max_evaluations && Metric::thread_evaluations() - start_evaluations >= criteria.max_evaluations)
+            reason = "evaluations";
+        else if (criteria.time_limit_ms &&
+                 chrono::duration<double, milli>(chrono::steady_clock::now() - start_time).count() >= criteria.time_limit_ms)
+            reason = "time";
+        else
+            return false;
+        return true;
     }
 
-    return new_position;
-}
+    int generations() const { return generation; }
 
-int getRandomIndex(int population_size) {
-    // Функция генерирует рандомное целое число - индекс для особи в популяции
-    random_device rd;
-    mt19937 gen(rd());
+    void interrupt(const char* why) {
+        // Остановка по внешней причине (например, другой остров уже встроил порцию)
+        reason = why;
+    }
+
+    StopReport report() const {
+        StopReport result;
+        result.generations = generation;
+        result.evaluations = Metric::thread_evaluations() - start_evaluations;
+        if (generation > 0 && generation < num_iterations)
+            result.evaluations_saved = result.evaluations * (num_iterations - generation) / generation;
+        result.reason = reason;
+        return result;
+    }
+};
 
-    uniform_int_distribution<int> uniform_dist(0, population_size - 1);
+class MigrationBuffer{
+    /*
+    *   Передача лучшей особи от одного острова другому без блокировок (тройной буфер)
+        Писатель заполняет свой слот и меняет его местами со средним, читатель забирает средний слот,
+        если писатель успел положить туда новую особь; слоты выделяются один раз при создании
+        Один писатель и один читатель
+    */
+    private:
+    struct Slot{
+        double fitness = -INFINITY;
+        vector<double> agent;
+    };
+    static const unsigned FRESH = 4; // в среднем слоте новая особь
+    array<Slot, 3> slots;
+    atomic<unsigned> middle{1};
+    unsigned back = 0; // слот писателя
+    unsigned front = 2; // слот читателя
 
-    return uniform_dist(gen);
-}
+    public:
+    explicit MigrationBuffer(size_t dimensions) {
+        for (Slot& slot : slots)
+            slot.agent.resize(dimensions);
+    }
 
-double getRandomValue(double low, double high) {
-    // Функция генерирует случайное нецелое число в интервале (low,high)
-    random_device rd;
-    mt19937 rng(rd());
-    uniform_real_distribution<double> distribution(low, high);
-    double randomInteger = distribution(rng);
-    return double(randomInteger);
-}
+    void publish(const double* agent, double fitness) {
+        Slot& slot = slots[back];
+        copy(agent, agent + slot.agent.size(), slot.agent.begin());
+        slot.fitness = fitness;
+        back = middle.exchange(back | FRESH, memory_order_acq_rel) & 3;
+    }
 
-vector<double> updatePosition(const vector<double>& agent, double t, pair<double,double> search) {
-    vector<double> new_position(agent.size());
-    for(size_t i = 0; i < agent.size(); i++) {
-        double amplitude = (search.second - search.first) / 2.0;
-        new_position[i] = agent[i] + amplitude * sin(2 * M_PI * t);
-        // Обеспечиваем, что новая позиция находится в пределах пространства поиска
-        new_position[i] = clamp(new_position[i], search.first, search.second);
+    bool receive(double* agent, double& fitness) {
+        // Последняя опубликованная особь (копируется в agent), false - ничего нового с прошлого вызова
+        if (!(middle.load(memory_order_acquire) & FRESH))
+            return false;
+        front = middle.exchange(front, memory_order_acq_rel) & 3;
+        copy(slots[front].agent.begin(), slots[front].agent.end(), agent);
+        fitness = slots[front].fitness;
+        return true;
+    }
+};
+
+struct IslandLink{
+    /*
+    *   Связь острова с соседями в модели островов (ISLANDS) или с соперниками в портфеле (PORTFOLIO)
+    */
+    MigrationBuffer* outbox; // сюда публикуется лучшая особь острова
+    MigrationBuffer* inbox; // отсюда приходит лучшая особь соседнего острова
+    atomic<int>* stop; // общий флаг остановки: наименьшее поколение, в котором какой-то остров превысил cancel_above
+                       // (INT_MAX - никто); остальные острова останавливаются, дойдя до этого поколения
+    int interval; // поколений между миграциями (0 - без миграции)
+    double cancel_above = INFINITY; // значение метрики, превысив которое остров останавливает себя и остальных
+    int won_generation = INT_MAX; // поколение, в котором этот остров превысил cancel_above
+};
+
+class Optimizer{
+    /*
+    *   Общий интерфейс метаэвристик
+        Популяция передается в конструктор и перемещается внутрь (без копирования),
+        optimize возвращает лучшее значение метрики и особь, показывающую его
+    */
+    public:
+    StopCriteria stop_criteria; // условия досрочной остановки (по умолчанию - все поколения)
+    StopReport stop_report; // итог последнего вызова optimize
+    IslandLink* island = nullptr; // связь с другими островами (только внутри ISLANDS)
+
+    virtual ~Optimizer() = default;
+    virtual pair<double, vector<double>> optimize(Metric& obj) = 0;
+
+    protected:
+    bool end_generation(StopPolicy& stop, double best_fitness, Population* agents = nullptr, int* immigrant = nullptr) {
+        /*
+        *   Конец поколения: миграция (если метаэвристика работает островом) и проверка условий остановки
+            Раз в island->interval поколений лучшая особь agents публикуется соседу, а особь, пришедшая
+            от другого соседа, заменяет худшую, если она лучше; в immigrant записывается номер замененной особи
+            (-1 - замены не было), метаэвристика обновляет по нему свои данные об особях
+            Возвращает true, если пора остановиться
+        */
+        if (immigrant)
+            *immigrant = -1;
+        if (island && island->interval && agents && incoming.size() != agents->dimensions())
+            incoming.resize(agents->dimensions()); // один раз, в первом поколении
+        if (island && island->interval && agents && ++migration_generation % island->interval == 0) {
+            double* fitness = agents->fitness();
+            size_t best = max_element(fitness, fitness + agents->size()) - fitness;
+            size_t worst = min_element(fitness, fitness + agents->size()) - fitness;
+            island->outbox->publish((*agents)[best], fitness[best]);
+            double incoming_fitness;
+            if (island->inbox->receive(incoming.data(), incoming_fitness) && incoming_fitness > fitness[worst]) {
+                agents->assign(worst, incoming.data());
+                fitness[worst] = incoming_fitness;
+                best_fitness = max(best_fitness, incoming_fitness);
+                if (immigrant)
+                    *immigrant = worst;
+            }
+        }
+        bool done = stop.should_stop(best_fitness);
+        int generation = stop.generations();
+        if (island && best_fitness > island->cancel_above) {
+            // результат достаточно хорош - остальные острова останавливаются, дойдя до этого поколения
+            island->won_generation = generation;
+            int first = island->stop->load(memory_order_relaxed);
+            while (generation < first && !island->stop->compare_exchange_weak(first, generation, memory_order_relaxed))
+                ;
+            if (!done)
+                stop.interrupt("won");
+            return true;
+        }
+        if (done)
+            return true;
+        if (island && generation >= island->stop->load(memory_order_relaxed)) {
+            stop.interrupt("island");
+            return true;
+        }
+        return false;
     }
-    return new_position;
-}
 
-class TLBO{
+    private:
+    int migration_generation = 0;
+    vector<double> incoming; // особь от соседнего острова
+};
+
+struct OptimizerBudget{
+    /*
+    *   Параметры запуска метаэвристики, общие для всех
+    */
+    int population_size = 128;
+    int num_iterations = 128;
+    int num_features = 64;
+    int searching = 10; // пространство поиска
+    int num_empires = 10; // число империй (ICA)
+    StopCriteria stop; // условия досрочной остановки
+};
+
+// Создание метаэвристики по начальной популяции и параметрам
+typedef unique_ptr<Optimizer> (*OptimizerFactory)(Population population, const OptimizerBudget& budget);
+
+class TLBO : public Optimizer{
     /*
     *   Класс метаэвристики TLBO
         Задается параметрами:
@@ -516,14 +2271,14 @@ class TLBO{
     int population_size;
     int num_iterations;
     int num_features;
-    vector<vector<double>> population;
+    Population population;
 
     public:
-    TLBO(const vector<vector<double>>& initial_population, int population_size, int num_iterations, int num_features)
-        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), population(initial_population) {
+    TLBO(Population initial_population, int population_size, int num_iterations, int num_features)
+        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), population(move(initial_population)) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики TLBO
             На входе - объект класса метрики
@@ -531,35 +2286,37 @@ class TLBO{
         */
 
     
-        vector<double> fitness; // вектор, содержащий значения кач-ва для каждой особи
-        for (int i = 0; i < population.size(); i++){
-            pair<double, vector<double>> pr = obj.metric(population[i]);
-            population[i] = pr.second; // обновление особи после метрики, с учетом ограничений
-            fitness.push_back(pr.first);
-        }
+        double* fitness = population.fitness(); // значения кач-ва для каждой особи
+        obj.evaluate_batch(population, 0, population.size()); // обновление особи после метрики, с учетом ограничений
+
+        // буферы под учителя, среднее и новые особи - выделяются один раз на всю оптимизацию
+        vector<double> teacher(num_features), population_mean(num_features);
+        vector<double> difference(num_features), repaired(num_features), random(2 * num_features);
+        Population students(population_size, num_features); // особи после стадии учителя
+        const double* student_fitness = students.fitness();
 
+        StopPolicy stop(stop_criteria, num_iterations);
         for (int h = 0; h < num_iterations; h++){
             // Стадия учителя
             int best_index = 0;
-            for (int i = 0; i < fitness.size();i++)
+            for (int i = 0; i < population_size;i++)
                 if (fitness[i] > fitness[best_index]) // поиск учителя
                     best_index = i;
             
-            vector<double> teacher = population[best_index]; // учитель
-            vector <double> population_mean = meanAlongAxis(population);
+            teacher.assign(population[best_index], population[best_index] + num_features); // учитель
+            population.mean(population_mean.data());
 
+            // ученики обучаются независимо друг от друга, поэтому оцениваются одним пакетом
             for (int i = 0; i < population_size;i++){
                 if (i != best_index){ // если это не учитель 
-                    vector<double> difference = calculateDifference(teacher,population_mean);
-                    for (int j = 0; j < difference.size(); j++)
-                        difference[j] += population[i][j];
-                    
-                    double old_score = fitness[i];
-                    pair<double,vector<double>> new_sc_d = obj.metric(difference);
-                    if (new_sc_d.first > old_score){ // проверка, обучил ли учитель ученика 
-                        population[i] = new_sc_d.second; // если да - обновляем значение особи и значение метрики для нее 
-                        fitness[i] = new_sc_d.first;
-                    }
+                    calculateDifference(teacher.data(),population_mean.data(),population[i],random.data(),students[i],num_features);
+                }
+            }
+            obj.evaluate_screened(students, population, 0, population_size, best_index); // место учителя не оценивается
+            for (int i = 0; i < population_size;i++){
+                if (i != best_index && student_fitness[i] > fitness[i]){ // проверка, обучил ли учитель ученика 
+                    population.assign(i, students[i]); // если да - обновляем значение особи и значение метрики для нее 
+                    fitness[i] = student_fitness[i];
                 }
             }
 
@@ -572,41 +2329,48 @@ class TLBO{
                     random_index_2 = getRandomIndex(population_size);
                 }
                 double rand1_sc = fitness[random_index_1],rand2_sc = fitness[random_index_2];
-                vector<double> rand1_bl = population[random_index_1], rand2_bl = population[random_index_2];
+                const double* rand1_bl = population[random_index_1];
+                const double* rand2_bl = population[random_index_2];
 
-                vector <double> new_population;
                 if (rand1_sc > rand2_sc){ // сравниваем их значения метрики
-                    new_population = calculateDifferenceRand(rand1_bl,rand2_bl,population[i]);
+                    calculateDifferenceRand(rand1_bl,rand2_bl,population[i],random.data(),difference.data(),num_features);
                 }
                 else{
-                    new_population = calculateDifferenceRand(rand2_bl,rand1_bl,population[i]);
+                    calculateDifferenceRand(rand2_bl,rand1_bl,population[i],random.data(),difference.data(),num_features);
                 }
 
                 double old_score = fitness[i];
-                pair<double,vector<double>> new_sc_d = obj.metric(new_population);
-                if (new_sc_d.first > old_score){ // проверка - лучше ли стало, по сравнению с изначальным
-                    population[i] = new_sc_d.second; // если да - обновляем особь, меняем значения метрики
-                    fitness[i] = new_sc_d.first;
+                double new_score = obj.promising(difference.data(), population[i])
+                                   ? obj.evaluate(difference.data(), repaired.data()) : -INFINITY;
+                if (new_score > old_score){ // проверка - лучше ли стало, по сравнению с изначальным
+                    population.assign(i, repaired.data()); // если да - обновляем особь, меняем значения метрики
+                    fitness[i] = new_score;
                 }  
             }
+            if (end_generation(stop, *max_element(fitness, fitness + population_size), &population))
+                break;
         }
+        stop_report = stop.report();
         
-        // поиск лучшей особи с большим значением метрики
+        // поиск лучшей особи с большим значением метрики, копируется только найденная особь
         double max_fitness = 0;
-        vector <double> best_agent;
-        for (int i = 0; i < fitness.size(); i++){
+        int best_index = -1;
+        for (int i = 0; i < population_size; i++){
             if (fitness[i] > max_fitness){
                 max_fitness = fitness[i];
-                best_agent = population[i];
+                best_index = i;
             }
         }
+        vector <double> best_agent;
+        if (best_index >= 0)
+            best_agent = population.row(best_index);
 
         pair<double,vector<double>> to_ret = make_pair(max_fitness,best_agent);
         return to_ret;
     }
 };
 
-class SCA{
+class SCA : public Optimizer{
     /*
     *   Класс метаэвристики SCA
         Задается параметрами:
@@ -619,14 +2383,18 @@ class SCA{
     int population_size;
     int num_iterations;
     int num_features;
-    vector<vector<double>> agents; // Reference to the population used for Metric
+    Population agents;
 
     public:
-    SCA(const vector<vector<double>>& initial_population, int population_size, int num_iterations, int num_features)
-        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), agents(initial_population) {
+    SCA(Population initial_population, int population_size, int num_iterations, int num_features)
+        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), agents(move(initial_population)) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj, int flag = 0, double a_linear_component = 2.0) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
+        return optimize(obj, 0);
+    }
+
+    pair<double, vector<double>> optimize(Metric& obj, int flag, double a_linear_component = 2.0) {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики SCA
             На входе - объект класса метрики, flag - встраиваем 1 бит или несколько (для встраивания бит-флага 0)
@@ -634,24 +2402,22 @@ class SCA{
         */
 
         // значения метрики для каждой особи
-        double best_fitness = 0.0;
-        vector<double> fitness;
-        for (int i = 0; i < agents.size(); i++){
-            pair<double, vector<double>> pr = obj.metric(agents[i]);
-            agents[i] = pr.second;
-            fitness.push_back(pr.first);
-        }
+        double* fitness = agents.fitness();
+        int num_agents = static_cast<int>(agents.size());
+        obj.evaluate_batch(agents, 0, num_agents);
         int best_agent_index  = 0;
-        for (int i = 0; i < fitness.size();i++){
+        for (int i = 0; i < num_agents;i++){
             if (fitness[i] > fitness[best_agent_index])
                 best_agent_index = i;
         }
         // поиск лучшего агента и лучшего значения метрики
         double best_agent_fitness = fitness[best_agent_index];
-        vector <double> best_agent = agents[best_agent_index];
+        vector <double> best_agent = agents.row(best_agent_index);
+        vector <double> new_position(num_features);
+        StopPolicy stop(stop_criteria, num_iterations);
         // оптимизация метаэвристикой
         for (int t = 0; t < num_iterations; t++){
-           for (int i = 0; i < agents.size(); i++){
+           for (int i = 0; i < num_agents; i++){
                 double a_t = a_linear_component - double(t) * (a_linear_component / double(num_iterations));
                 double r1 = getRandomValue(0,1);
                 double r2 = getRandomValue(0,1);
@@ -661,34 +2427,44 @@ class SCA{
                 while (random_agent_index == i)
                    random_agent_index = getRandomIndex(population_size); 
                 
-                vector <double> random_agent = agents[random_agent_index];
-                vector <double> D = calculateDifferenceSCA(random_agent,agents[i],C);
-                vector <double> new_position = calculateDifferenceRandomPositonSCA(random_agent,D,A);
-
-                pair<double,vector<double>> now_func_bl = obj.metric(new_position);
-                if (now_func_bl.first > fitness[i]){
-                    agents[i] = now_func_bl.second;
-                    fitness[i] = now_func_bl.first;
+                const double* random_agent = agents[random_agent_index];
+                calculateDifferenceSCA(random_agent,agents[i],A,C,new_position.data(),num_features);
+
+                double new_fitness = obj.promising(new_position.data(), agents[i])
+                                     ? obj.evaluate(new_position.data(), new_position.data()) : -INFINITY;
+                if (new_fitness > fitness[i]){
+                    agents.assign(i, new_position.data());
+                    fitness[i] = new_fitness;
                     if (fitness[i] > best_agent_fitness){
                         best_agent_fitness = fitness[i];
-                        best_agent = agents[i];
+                        best_agent = new_position;
                     }
                 }
 
                 if (flag){ // при встраивании одного бита
                     if (best_agent_fitness > 0){
+                        stop_report = stop.report();
                         pair<double,vector<double>> to_ret = make_pair(best_agent_fitness,best_agent);
                         return to_ret;
                     }
                 }
             }
+            int immigrant;
+            bool done = end_generation(stop, best_agent_fitness, &agents, &immigrant);
+            if (immigrant >= 0 && fitness[immigrant] > best_agent_fitness) { // лучшая особь пришла с другого острова
+                best_agent_fitness = fitness[immigrant];
+                best_agent.assign(agents[immigrant], agents[immigrant] + num_features);
+            }
+            if (done)
+                break;
         }
+        stop_report = stop.report();
         pair<double,vector<double>> to_ret = make_pair(best_agent_fitness,best_agent);
         return to_ret;
     }
 };
 
-class DE{
+class DE : public Optimizer{
     /*
     *   Класс метаэвристики SCA
         Задается параметрами:
@@ -701,70 +2477,85 @@ class DE{
     int population_size;
     int num_iterations;
     int num_features;
-    vector<vector<double>> agents; // Reference to the population used for Metric
+    Population agents;
 
     public:
-    DE(const vector<vector<double>>& initial_population, int population_size, int num_iterations, int num_features)
-        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), agents(initial_population) {
+    DE(Population initial_population, int population_size, int num_iterations, int num_features)
+        : population_size(population_size), num_iterations(num_iterations), num_features(num_features), agents(move(initial_population)) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj, double cr = 0.3, double f = 0.1) { 
+    pair<double, vector<double>> optimize(Metric& obj) override {
+        return optimize(obj, 0.3);
+    }
+
+    pair<double, vector<double>> optimize(Metric& obj, double cr, double f = 0.1) { 
         /*  
             Функция реализует оптимизацию метрики с помощью метаэвристики DE
             На входе - объект класса метрики, flag - встраиваем 1 бит или несколько (для встраивания бит-флага 0)
             На выходе - лучшее значение метрики для всех особей в популяции, особь, показывающая лучшее значение метрики
         */
         // значения метрики для каждой особи
-        double best_fitness = 0.0;
-        vector<double> fitness;
-        for (int i = 0; i < agents.size(); i++){
-            pair<double, vector<double>> pr = obj.metric(agents[i]);
-            agents[i] = pr.second;
-            fitness.push_back(pr.first);
-        }
+        double* fitness = agents.fitness();
+        int num_agents = static_cast<int>(agents.size());
+        obj.evaluate_batch(agents, 0, num_agents);
         double best_agent_fitness = fitness[0];
-        vector <double> best_agent = agents[0];
-        vector<double> y(agents[0].size());
+        vector <double> best_agent = agents.row(0);
+        vector<double> y(agents.dimensions()), r(agents.dimensions());
+        // потомок отличается от особи i только в скрещенных значениях, поэтому при включенной инкрементальной оценке
+        // он считается от состояния особи i
+        vector<CandidateState> states(obj.incremental() ? agents.size() : 0);
+        for (size_t i = 0; i < states.size(); i++)
+            obj.state(agents[i], states[i]);
+        CandidateState child_state;
+        StopPolicy stop(stop_criteria, num_iterations);
         // оптимизация метаэвристикой
         for (int t = 0; t < num_iterations; t++){
-           for (int i = 0; i < agents.size(); i++){
-                //cout << rand() % 4096;;
+           for (int i = 0; i < num_agents; i++){
                 // выбор рандомных индексов, отличных от друг друга(a, b, c) и от i-го
                 int a_ind,b_ind,c_ind;
-                //a_ind = getRandomIndex(population_size);
-                //b_ind = getRandomIndex(population_size);
-                //c_ind = getRandomIndex(population_size);
-                a_ind = rand() % agents.size();
-                b_ind = rand() % agents.size();
-                c_ind = rand() % agents.size();
-//                while (a_ind == i) a_ind = getRandomIndex(population_size);
-//                while (b_ind == i || b_ind == a_ind) b_ind = getRandomIndex(population_size);
-//                while (c_ind == i || c_ind == a_ind || c_ind == b_ind) c_ind = getRandomIndex(population_size);
-               while (a_ind == i) a_ind = rand() % agents.size();
-               while (b_ind == i || b_ind == a_ind) b_ind = rand() % agents.size();
-               while (c_ind == i || c_ind == a_ind || c_ind == b_ind) c_ind = rand() % agents.size();
+                a_ind = getRandomIndex(agents.size());
+                b_ind = getRandomIndex(agents.size());
+                c_ind = getRandomIndex(agents.size());
+               while (a_ind == i) a_ind = getRandomIndex(agents.size());
+               while (b_ind == i || b_ind == a_ind) b_ind = getRandomIndex(agents.size());
+               while (c_ind == i || c_ind == a_ind || c_ind == b_ind) c_ind = getRandomIndex(agents.size());
                 // генерация возможной новой особи
 
-                
-                for (int pos = 0; pos < agents[0].size(); pos++){
-                    double r = getRandomValue(0,1);
-                    if (r < cr)
+                fill_uniform(r.data(), r.size(), 0, 1);
+                for (size_t pos = 0; pos < agents.dimensions(); pos++){
+                    if (r[pos] < cr)
                         y[pos] = agents[a_ind][pos] + f * (agents[b_ind][pos] - agents[c_ind][pos]);
                     else
                         y[pos] = agents[i][pos];
                 }
                 // проверка новой особи
-                pair<double, vector<double>> pr = obj.metric(y);
-                if (pr.first > fitness[i]){
-                    fitness[i] = pr.first;
-                    agents[i] = pr.second;
+                double new_fitness = obj.incremental() ? obj.evaluate_delta(agents[i], states[i], y.data(), y.data(), child_state, fitness[i])
+                                                       : obj.evaluate(y.data(), y.data());
+                if (new_fitness > fitness[i]){
+                    fitness[i] = new_fitness;
+                    agents.assign(i, y.data());
+                    if (obj.incremental())
+                        states[i] = child_state;
                     if (fitness[i] > best_agent_fitness){
                         best_agent_fitness = fitness[i];
-                        best_agent = agents[i];
+                        best_agent = y;
                     }
                 }
             }
+            int immigrant;
+            bool done = end_generation(stop, best_agent_fitness, &agents, &immigrant);
+            if (immigrant >= 0) { // особь с другого острова
+                if (obj.incremental())
+                    obj.state(agents[immigrant], states[immigrant]);
+                if (fitness[immigrant] > best_agent_fitness) {
+                    best_agent_fitness = fitness[immigrant];
+                    best_agent.assign(agents[immigrant], agents[immigrant] + num_features);
+                }
+            }
+            if (done)
+                break;
         }
+        stop_report = stop.report();
 
 //        // поиск лучшего агента
 //        double best_agent_fitness = 0;
@@ -783,7 +2574,7 @@ class DE{
     }
 };
 
-class SSA{
+class SSA : public Optimizer{
     /*
     *   Класс метаэвристики SSA
         Задается параметрами:
@@ -797,14 +2588,14 @@ private:
     int num_salps; // population_size
     int num_iterations;
     int num_dimensions; // num_features
-    vector<vector<double>> salps; // Reference to the population used for Metric
+    Population salps;
 
 public:
-    SSA(const vector<vector<double>>& initial_population,int searching, int num_salps, int num_iterations, int num_dimensions)
-            : searching(searching), num_salps(num_salps), num_iterations(num_iterations), num_dimensions(num_dimensions),salps(initial_population) {
+    SSA(Population initial_population,int searching, int num_salps, int num_iterations, int num_dimensions)
+            : searching(searching), num_salps(num_salps), num_iterations(num_iterations), num_dimensions(num_dimensions),salps(move(initial_population)) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики SCA
             На входе - объект класса метрики, flag - встраиваем 1 бит или несколько (для встраивания бит-флага 0)
@@ -812,58 +2603,49 @@ public:
         */
         const pair<double, double> search_space(static_cast<double>(-searching),static_cast<double>(searching));
         // Calculate fitness for each salp
-        vector<double> fitness(num_salps);
-        for (int i = 0; i < num_salps; ++i) {
-            pair<double, vector<double>> pr = obj.metric(salps[i]);
-            salps[i] = pr.second;
-            fitness[i] = pr.first;
-        }
+        double* fitness = salps.fitness();
+        obj.evaluate_batch(salps, 0, num_salps);
 
+        StopPolicy stop(stop_criteria, num_iterations);
         for (int t = 0; t < num_iterations; ++t) {
             // Get the best salp
-            int best_index = distance(fitness.begin(), max_element(fitness.begin(), fitness.end()));
-            vector<double> best_salp = salps[best_index];
+            int best_index = distance(fitness, max_element(fitness, fitness + num_salps));
+            if (best_index != 0)
+                salps.assign(0, salps[best_index]); // The first salp follows the lead
 
             // Update positions with adaptive parameter
             double w = 1.0 - (static_cast<double>(t) / num_iterations);
 
-            for (int i = 0; i < num_salps; ++i) {
+            for (int i = 1; i < num_salps; ++i) {
+                double* salp = salps[i];
+                const double* predecessor = salps[i - 1];
                 for (int j = 0; j < num_dimensions; ++j) {
-                    if (i == 0) {
-                        salps[i][j] = best_salp[j]; // The first salp follows the lead
-                    } else {
-                        // Subsequent salps follow their predecessor
-                        salps[i][j] = (salps[i][j] + salps[i - 1][j]) / 2;
-
-                        // Introduce randomization for the latter half of iterations
-                        if (t > num_iterations / 2) {
-                            salps[i][j] += w * (2.0 * static_cast<double>(rand()) / RAND_MAX - 1.0); // random value in [-1,1]
-                        }
-                        // Boundary check
-                        if (salps[i][j] < search_space.first) {
-                            salps[i][j] = search_space.first;
-                        } else if (salps[i][j] > search_space.second) {
-                            salps[i][j] = search_space.second;
-                        }
+                    // Subsequent salps follow their predecessor
+                    salp[j] = (salp[j] + predecessor[j]) / 2;
+
+                    // Introduce randomization for the latter half of iterations
+                    if (t > num_iterations / 2) {
+                        salp[j] += w * getRandomValue(-1.0, 1.0); // random value in [-1,1]
                     }
                 }
+                // Boundary check
+                salps.clamp(i, search_space.first, search_space.second);
             }
 
             // Update fitness values
-            for (int i = 0; i < num_salps; ++i) {
-                pair<double, vector<double>> pr = obj.metric(salps[i]);
-                salps[i] = pr.second;
-                fitness[i] = pr.first;
-            }
+            obj.evaluate_batch(salps, 0, num_salps);
+            if (end_generation(stop, *max_element(fitness, fitness + num_salps), &salps))
+                break;
         }
+        stop_report = stop.report();
 
-        int best_index = distance(fitness.begin(), max_element(fitness.begin(), fitness.end()));
-        pair<double,vector<double>> to_ret = make_pair(fitness[best_index],salps[best_index]);
+        int best_index = distance(fitness, max_element(fitness, fitness + num_salps));
+        pair<double,vector<double>> to_ret = make_pair(fitness[best_index],salps.row(best_index));
         return to_ret;
     }
 };
 
-class WOA{
+class WOA : public Optimizer{
     /*
     *   Класс метаэвристики WOA
         Задается параметрами:
@@ -876,29 +2658,27 @@ private:
     int num_agents;
     int num_iterations;
     int num_features;
-    vector<vector<double>> agents;
+    Population agents;
     int searching;
 public:
-    WOA(const vector<vector<double>>& initial_population, int num_agents, int num_iterations, int num_features,int searching)
-            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(initial_population),searching(searching) {
+    WOA(Population initial_population, int num_agents, int num_iterations, int num_features,int searching)
+            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(move(initial_population)),searching(searching) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики WOA
             На входе - объект класса метрики
             На выходе - лучшее значение метрики для всех особей в популяции, особь, показывающая лучшее значение метрики
         */
         double best_fitness = 0;
-        vector <double> best_fitness_vec;
-        vector<double> fitness(num_agents);
+        vector <double> best_fitness_vec(num_features);
+        double* fitness = agents.fitness();
         const pair<double, double> search_space(static_cast<double>(-searching),static_cast<double>(searching));
-        for(int i = 0; i < num_agents; i++) {
-            pair<double, vector<double>> pr = obj.metric(agents[i]);
-            agents[i] = pr.second; // обновление особи после метрики, с учетом ограничений
-            fitness.push_back(pr.first);
-        }
+        obj.evaluate_batch(agents, 0, num_agents); // обновление особи после метрики, с учетом ограничений
 
+        vector<double> X_new(num_features);
+        StopPolicy stop(stop_criteria, num_iterations);
         for (int t = 0; t < num_iterations; t++) {
             double a = 2.0 - t * ((2.0) / num_iterations);
 
@@ -914,50 +2694,46 @@ public:
 
                 double p = getRandomValue(0, 1);
 
-                vector<double> X_rand = agents[getRandomIndex(num_agents)];
-                vector<double> D_X_rand(num_features);
-                vector<double> X_new(num_features);
+                const double* X_rand = agents[getRandomIndex(num_agents)];
 
                 if(p < 0.5) {
-                    if(fabs(A) < 1) {
-                        for(int j = 0; j < num_features; j++) {
-                            D_X_rand[j] = fabs(C * X_rand[j] - agents[i][j]);
-                            X_new[j] = X_rand[j] - A * D_X_rand[j];
-                        }
-                    } else {
-                        for(int j = 0; j < num_features; j++) {
-                            X_new[j] = X_rand[j] - A * fabs(C * X_rand[j] - agents[i][j]);
-                        }
-                    }
+                    // при |A| < 1 и при |A| >= 1 формула сдвига одна и та же, отличается только смысл X_rand
+                    UPDATE_KERNELS.encircle(X_rand, agents[i], A, C, X_new.data(), num_features);
                 } else {
-                    for(int j = 0; j < num_features; j++) {
-                        D_X_rand[j] = fabs(X_rand[j] - agents[i][j]);
-                        X_new[j] = D_X_rand[j] * exp(b * l) * cos(2 * M_PI * l) + X_rand[j];
-                    }
+                    // exp и cos зависят только от l, поэтому считаются один раз на агента
+                    UPDATE_KERNELS.spiral(X_rand, agents[i], exp(b * l), cos(2 * M_PI * l), X_new.data(), num_features);
                 }
 
-                for(int j = 0; j < num_features; j++) {
-                    X_new[j] = clamp(X_new[j], search_space.first, search_space.second);
-                }
+                vec_clamp(X_new.data(), num_features, search_space.first, search_space.second);
 
-                pair<double, vector<double>> pr  = obj.metric(X_new);
-                if(pr.first > fitness[i]) {
-                    agents[i] = pr.second;
-                    fitness[i] = pr.first;
+                double new_fitness = obj.promising(X_new.data(), agents[i])
+                                     ? obj.evaluate(X_new.data(), X_new.data()) : -INFINITY;
+                if(new_fitness > fitness[i]) {
+                    agents.assign(i, X_new.data());
+                    fitness[i] = new_fitness;
                 }
-                if (pr.first > best_fitness){
-                    best_fitness = pr.first;
-                    best_fitness_vec = pr.second;
+                if (new_fitness > best_fitness){
+                    best_fitness = new_fitness;
+                    best_fitness_vec = X_new;
                 }
             }
+            int immigrant;
+            bool done = end_generation(stop, best_fitness, &agents, &immigrant);
+            if (immigrant >= 0 && fitness[immigrant] > best_fitness) { // лучшая особь пришла с другого острова
+                best_fitness = fitness[immigrant];
+                best_fitness_vec.assign(agents[immigrant], agents[immigrant] + num_features);
+            }
+            if (done)
+                break;
         }
+        stop_report = stop.report();
 
         pair<double,vector<double>> to_ret = make_pair(best_fitness,best_fitness_vec);
         return to_ret;
     }
 };
 
-class ICA{
+class ICA : public Optimizer{
     /*
     *   Класс метаэвристики ICA
         Задается параметрами:
@@ -970,42 +2746,39 @@ private:
     int num_agents;
     int num_iterations;
     int num_features;
-    vector<vector<double>> agents;
+    Population agents;
     int searching;
     int num_empires;
 public:
-    ICA(const vector<vector<double>>& initial_population, int num_agents, int num_iterations, int num_features,int searching, int num_empires)
-            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(initial_population),searching(searching),num_empires(num_empires) {
+    ICA(Population initial_population, int num_agents, int num_iterations, int num_features,int searching, int num_empires)
+            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(move(initial_population)),searching(searching),num_empires(num_empires) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики ICA
             На входе - объект класса метрики
             На выходе - лучшее значение метрики для всех особей в популяции, особь, показывающая лучшее значение метрики
         */
-        vector<double> fitness(num_agents);
-        for (int i = 0; i < num_agents; ++i) {
-            pair<double, vector<double>> pr = obj.metric(agents[i]);
-            agents[i] = pr.second;
-            fitness[i] = pr.first;
-        }
+        const double* fitness = agents.fitness();
+        obj.evaluate_batch(agents, 0, num_agents);
 
         vector<int> sorted_indices(num_agents);
         iota(sorted_indices.begin(), sorted_indices.end(), 0);
-        sort(sorted_indices.begin(), sorted_indices.end(), [&fitness](int i1, int i2) { return fitness[i1] > fitness[i2]; });
+        sort(sorted_indices.begin(), sorted_indices.end(), [fitness](int i1, int i2) { return fitness[i1] > fitness[i2]; });
 
-        vector<vector<double>> empires(num_empires);
-        vector<vector<double>> colonies(num_agents - num_empires);
-        vector<double> empire_fitness(num_empires);
-        vector<double> colony_fitness(num_agents - num_empires);
+        Population empires(num_empires, num_features);
+        int num_colonies = num_agents - num_empires;
+        Population colonies(num_colonies, num_features);
+        double* empire_fitness = empires.fitness();
+        double* colony_fitness = colonies.fitness();
 
         for (int i = 0; i < num_empires; ++i) {
-            empires[i] = agents[sorted_indices[i]];
+            empires.assign(i, agents[sorted_indices[i]]);
             empire_fitness[i] = fitness[sorted_indices[i]];
         }
-        for (int i = 0; i < colonies.size(); ++i) {
-            colonies[i] = agents[sorted_indices[i + num_empires]];
+        for (int i = 0; i < num_colonies; ++i) {
+            colonies.assign(i, agents[sorted_indices[i + num_empires]]);
             colony_fitness[i] = fitness[sorted_indices[i + num_empires]];
         }
 
@@ -1015,65 +2788,57 @@ public:
         double assimilation_coeff_init = 0.5;
         double assimilation_coeff_final = 0.1;
 
+        vector<double> child(num_features), noise(num_features);
+        StopPolicy stop(stop_criteria, num_iterations);
         for (int t = 0; t < num_iterations; ++t) {
             double assimilation_coeff = assimilation_coeff_init - (assimilation_coeff_init - assimilation_coeff_final) * static_cast<double>(t) / num_iterations;
             double learning_rate = learning_rate_init - (learning_rate_init - learning_rate_final) * static_cast<double>(t) / num_iterations;
 
             // Осуществляем скрещивание между империями
             for (int i = 0; i < num_empires; ++i) {
-                if (static_cast<double>(rand()) / RAND_MAX < 0.5) {
-                    int other = rand() % num_empires;
-                    vector<double> child(num_features);
+                if (getRandomValue(0, 1) < 0.5) {
+                    int other = getRandomIndex(num_empires);
                     for (int j = 0; j < num_features; ++j) {
                         child[j] = 0.5 * (empires[i][j] + empires[other][j]);
                     }
-                    pair<double, vector<double>> pr  = obj.metric(child);
-                    if (pr.first > empire_fitness[i]) {
-                        empires[i] = pr.second;
-                        empire_fitness[i] = pr.first;
+                    double child_fitness = obj.evaluate(child.data(), child.data());
+                    if (child_fitness > empire_fitness[i]) {
+                        empires.assign(i, child.data());
+                        empire_fitness[i] = child_fitness;
                     }
                 }
             }
 
             // Обновление позиций колоний на основе их соответствующих империй
-            for (int i = 0; i < colonies.size(); ++i) {
+            for (int i = 0; i < num_colonies; ++i) {
+                double* colony = colonies[i];
+                const double* empire = empires[i % num_empires];
                 for (int j = 0; j < num_features; ++j) {
-                    colonies[i][j] -= learning_rate * assimilation_coeff * (colonies[i][j] - empires[i % num_empires][j]);
+                    colony[j] -= learning_rate * assimilation_coeff * (colony[j] - empire[j]);
                 }
             }
 
             // Осуществляем революцию, внося случайные возмущения
-            for (int i = 0; i < colonies.size(); ++i) {
-                for (int j = 0; j < num_features; ++j) {
-                    colonies[i][j] += 0.2 * static_cast<double>(rand()) / RAND_MAX;
-                }
+            for (int i = 0; i < num_colonies; ++i) {
+                fill_uniform(noise.data(), num_features, 0, 0.2);
+                colonies.axpy(i, 1.0, noise.data());
             }
 
             // Обновление приспособленности всех агентов
-            for (int i = 0; i < num_empires; ++i) {
-                pair<double, vector<double>> pr  = obj.metric(empires[i]);
-                empire_fitness[i] = pr.first;
-                empires[i] = pr.second;
-            }
-            for (int i = 0; i < colonies.size(); ++i) {
-                pair<double, vector<double>> pr  = obj.metric(colonies[i]);
-                colony_fitness[i] = pr.first;
-                colonies[i] = pr.second;
-            }
-
-            // Поиск лучшей империи
-            int best_index = distance(empire_fitness.begin(), max_element(empire_fitness.begin(), empire_fitness.end()));
-            auto best_agent = empires[best_index];
-            double best_fitness = empire_fitness[best_index];
-                                                   }
+            obj.evaluate_batch(empires, 0, num_empires);
+            obj.evaluate_batch(colonies, 0, colonies.size());
+            if (end_generation(stop, *max_element(empire_fitness, empire_fitness + num_empires))) // империи и колонии не мигрируют
+                break;
+        }
+        stop_report = stop.report();
 
-        int best_index = distance(empire_fitness.begin(), max_element(empire_fitness.begin(), empire_fitness.end()));;
-        pair<double,vector<double>> to_ret = make_pair(empire_fitness[best_index],empires[best_index]);
+        int best_index = distance(empire_fitness, max_element(empire_fitness, empire_fitness + num_empires));
+        pair<double,vector<double>> to_ret = make_pair(empire_fitness[best_index],empires.row(best_index));
         return to_ret;
     }
 }; // num_empires??
 
-class AOA{
+class AOA : public Optimizer{
     /*
     *   Класс метаэвристики AOA
         Задается параметрами:
@@ -1086,90 +2851,433 @@ private:
     int num_agents;
     int num_iterations;
     int num_features;
-    vector<vector<double>> agents;
+    Population agents;
     int searching;
 public:
-    AOA(const vector<vector<double>>& initial_population, int num_agents, int num_iterations, int num_features,int searching)
-            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(initial_population),searching(searching) {
+    AOA(Population initial_population, int num_agents, int num_iterations, int num_features,int searching)
+            : num_agents(num_agents), num_iterations(num_iterations), num_features(num_features), agents(move(initial_population)),searching(searching) {
     }
 
-    pair<double, vector<double>> optimize(Metric& obj) {
+    pair<double, vector<double>> optimize(Metric& obj) override {
         /*
             Функция реализует оптимизацию метрики с помощью метаэвристики AOA
             На входе - объект класса метрики
             На выходе - лучшее значение метрики для всех особей в популяции, особь, показывающая лучшее значение метрики
         */
         pair<double,double> search(static_cast<double>(-searching),static_cast<double>(searching));
-        vector<double> fitness(num_agents);
-        for (int i = 0; i < num_agents; ++i) {
-            pair<double, vector<double>> pr = obj.metric(agents[i]);
-            agents[i] = pr.second;
-            fitness[i] = pr.first;
-        }
+        double* fitness = agents.fitness();
+        obj.evaluate_batch(agents, 0, num_agents);
         // Основной цикл оптимизации
+        // новые позиции агентов зависят только от их текущих позиций, поэтому оцениваются одним пакетом
+        Population new_positions(num_agents, num_features);
+        const double* new_fitness = new_positions.fitness();
+        StopPolicy stop(stop_criteria, num_iterations);
         for (int t = 0; t < num_iterations; t++) {
             double time_ratio = static_cast<double>(t) / num_iterations;
 
+            for (int i = 0; i < num_agents; i++)
+                updatePosition(agents[i], time_ratio, search, new_positions[i], num_features);
+            obj.evaluate_screened(new_positions, agents, 0, num_agents);
             for (int i = 0; i < num_agents; i++) {
-                vector<double> new_position = updatePosition(agents[i], time_ratio, search);
-                pair<double, vector<double>> pr  = obj.metric(new_position);
-                if (pr.first > fitness[i]) {
-                    agents[i] = pr.second;
-                    fitness[i] = pr.first;
+                if (new_fitness[i] > fitness[i]) {
+                    agents.assign(i, new_positions[i]);
+                    fitness[i] = new_fitness[i];
                 }
             }
+            if (end_generation(stop, *max_element(fitness, fitness + num_agents), &agents))
+                break;
         }
+        stop_report = stop.report();
 
-        auto max_element_iter = max_element(fitness.begin(), fitness.end());
-        int best_index = distance(fitness.begin(), max_element_iter);
-        pair<double,vector<double>> to_ret = make_pair(fitness[best_index],agents[best_index]);
+        auto max_element_iter = max_element(fitness, fitness + num_agents);
+        int best_index = distance(fitness, max_element_iter);
+        pair<double,vector<double>> to_ret = make_pair(fitness[best_index],agents.row(best_index));
         return to_ret;
     }
 };
 
-double psnr(vector<vector<int>> original_img,vector<vector<int>> saved_img){
+unique_ptr<Optimizer> make_islands(Population population, const OptimizerBudget& budget);
+unique_ptr<Optimizer> make_portfolio(Population population, const OptimizerBudget& budget);
+
+map<string, OptimizerFactory>& optimizer_registry() {
+    /*
+        Реестр метаэвристик: имя -> функция создания
+        Новая метаэвристика подключается через register_optimizer
+    */
+    static map<string, OptimizerFactory> registry{
+        {"tlbo", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<TLBO>(move(population), b.population_size, b.num_iterations, b.num_features); }},
+        {"sca", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<SCA>(move(population), b.population_size, b.num_iterations, b.num_features); }},
+        {"de", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<DE>(move(population), b.population_size, b.num_iterations, b.num_features); }},
+        {"ssa", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<SSA>(move(population), b.searching, b.population_size, b.num_iterations, b.num_features); }},
+        {"woa", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<WOA>(move(population), b.population_size, b.num_iterations, b.num_features, b.searching); }},
+        {"aoa", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<AOA>(move(population), b.population_size, b.num_iterations, b.num_features, b.searching); }},
+        {"ica", [](Population population, const OptimizerBudget& b) -> unique_ptr<Optimizer> {
+            return make_unique<ICA>(move(population), b.population_size, b.num_iterations, b.num_features, b.searching, b.num_empires); }},
+        {"islands", make_islands},
+        {"portfolio", make_portfolio},
+    };
+    return registry;
+}
+
+void register_optimizer(const string& name, OptimizerFactory factory) {
+    // Добавление (или замена) метаэвристики в реестре
+    optimizer_registry()[name] = factory;
+}
+
+unique_ptr<Optimizer> create_optimizer(OptimizerFactory factory, Population population, const OptimizerBudget& budget) {
+    // Создание метаэвристики с условиями остановки из budget
+    unique_ptr<Optimizer> optimizer = factory(move(population), budget);
+    optimizer->stop_criteria = budget.stop;
+    return optimizer;
+}
+
+OptimizerFactory find_optimizer(const string& name) {
+    // Поиск метаэвристики по имени, неизвестное имя - исключение
+    auto it = optimizer_registry().find(name);
+    if (it == optimizer_registry().end())
+        throw invalid_argument("unknown metaheuristic: " + name);
+    return it->second;
+}
+
+class ISLANDS : public Optimizer{
+    /*
+    *   Модель островов: несколько метаэвристик оптимизируют одну метрику одновременно, каждая на своей части
+        популяции, и раз в migration_interval поколений передают лучшую особь соседу по кольцу (MigrationBuffer)
+        Остальные условия остановки у каждого острова свои, а target_fitness общее: как только один остров
+        его превысил, все острова останавливаются, дойдя до этого поколения (общий флаг IslandLink),
+        так же, как остановилась бы одиночная метаэвристика
+        Острова выполняются одновременно в собственных потоках (run_concurrently), в том числе внутри
+        embed_blocks, где блок уже занимает поток пула
+        Ограничение max_evaluations у каждого острова свое (оценки считаются по потоку острова)
+        Итог зависит от того, в какой момент острова обмениваются особями, поэтому точно не воспроизводится
+    */
+    private:
+    vector<unique_ptr<Optimizer>> islands;
+    vector<size_t> island_sizes; // размеры популяций островов
+    int num_iterations;
+    int num_features;
+    int migration_interval;
+    double target_fitness;
+
+    public:
+    ISLANDS(Population initial_population, const OptimizerBudget& budget, const vector<string>& names, int migration_interval = 4)
+        : num_iterations(budget.num_iterations), num_features(budget.num_features), migration_interval(migration_interval),
+          target_fitness(budget.stop.target_fitness) {
+        // популяция делится между островами поровну
+        size_t count = names.size();
+        for (size_t k = 0; k < count; k++) {
+            size_t begin = initial_population.size() * k / count, end = initial_population.size() * (k + 1) / count;
+            Population part(end - begin, initial_population.dimensions());
+            for (size_t i = begin; i < end; i++)
+                part.assign(i - begin, initial_population[i]);
+            OptimizerBudget island_budget = budget;
+            island_budget.population_size = end - begin;
+            island_sizes.push_back(end - begin);
+            islands.push_back(create_optimizer(find_optimizer(names[k]), move(part), island_budget));
+        }
+    }
+
+    pair<double, vector<double>> optimize(Metric& obj) override {
+        /*
+            Функция реализует оптимизацию метрики моделью островов
+            На входе - объект класса метрики (общий для всех островов)
+            На выходе - лучшее значение метрики по всем островам и особь, показывающая его
+        */
+        size_t count = islands.size();
+        vector<unique_ptr<MigrationBuffer>> buffers;
+        for (size_t k = 0; k < count; k++)
+            buffers.push_back(make_unique<MigrationBuffer>(num_features));
+        atomic<int> stop{INT_MAX};
+        vector<IslandLink> links(count);
+        for (size_t k = 0; k < count; k++) {
+            links[k] = {buffers[k].get(), buffers[(k + count - 1) % count].get(), &stop, migration_interval, target_fitness};
+            islands[k]->island = &links[k];
+        }
+
+        // у каждого острова свой поток случайных чисел
+        uint64_t islands_key = thread_rng()();
+        long long start_evaluations = obj.evaluations();
+        vector<pair<double, vector<double>>> results(count);
+        CostAccumulator* cost = current_cost();
+        run_concurrently(count, [&](size_t k) {
+            CostScope cost_scope(cost);
+            if (stop.load(memory_order_relaxed) != INT_MAX) { // цель уже достигнута другим островом - остров не запускается
+                islands[k]->stop_report = StopReport();
+                islands[k]->stop_report.reason = "island";
+                // хотя бы по одной оценке на особь в начальной популяции и в каждом поколении
+                islands[k]->stop_report.evaluations_saved = (long long)island_sizes[k] * (num_iterations + 1);
+                return;
+            }
+            RandomStream island_stream(mix64(islands_key + k));
+            results[k] = islands[k]->optimize(obj);
+        });
+
+        // сэкономленные оценки - по бюджету и числу поколений каждого острова
+        size_t best = 0;
+        stop_report = StopReport();
+        for (size_t k = 0; k < count; k++) {
+            islands[k]->island = nullptr;
+            if (results[k].first > results[best].first)
+                best = k;
+            stop_report.generations = max(stop_report.generations, islands[k]->stop_report.generations);
+            stop_report.evaluations_saved += islands[k]->stop_report.evaluations_saved;
+        }
+        stop_report.evaluations = obj.evaluations() - start_evaluations;
+        stop_report.reason = islands[best]->stop_report.reason;
+        return results[best];
+    }
+};
+
+unique_ptr<Optimizer> make_islands(Population population, const OptimizerBudget& budget) {
+    // Острова TLBO, DE и WOA
+    return make_unique<ISLANDS>(move(population), budget, vector<string>{"tlbo", "de", "woa"});
+}
+
+class PORTFOLIO : public Optimizer{
+    /*
+    *   Гонка метаэвристик на одном блоке: каждая оптимизирует одну и ту же метрику со своей копией
+        начальной популяции, и как только одна из них встроила порцию с psnr не меньше min_psnr,
+        остальные останавливаются, дойдя до того же поколения (общий флаг IslandLink, без миграции)
+        Метаэвристики выполняются одновременно в собственных потоках (run_concurrently), в том числе внутри
+        embed_blocks, где блок уже занимает поток пула
+        Победитель записывается в stop_report.winner: метаэвристика, достигшая порога в самом раннем поколении
+        (из достигших в одном поколении и если порог не достиг никто - с лучшим значением метрики, затем первая в names)
+        Воспроизводимость: у каждой метаэвристики свой поток случайных чисел (из одного числа вызывающего
+        потока), а остановка зависит только от номеров поколений, поэтому при том же seed победитель и его
+        значение метрики и особь одинаковы при любом числе потоков и любой их загрузке. Не воспроизводятся:
+        общее число оценок (метаэвристика, обогнавшая победителя, останавливается в конце своего текущего
+        поколения), остановка по time_limit_ms и гонка с кэшем или отсевом оценок метрики (они общие у всех)
+    */
+    private:
+    vector<string> names;
+    vector<unique_ptr<Optimizer>> racers;
+    double min_psnr;
+
+    public:
+    PORTFOLIO(Population initial_population, const OptimizerBudget& budget, const vector<string>& names, double min_psnr = 40)
+        : names(names), min_psnr(min_psnr) {
+        for (const string& name : names)
+            racers.push_back(create_optimizer(find_optimizer(name), initial_population, budget));
+    }
+
+    pair<double, vector<double>> optimize(Metric& obj) override {
+        /*
+            Функция реализует гонку метаэвристик портфеля
+            На входе - объект класса метрики (общий для всех метаэвристик)
+            На выходе - значение метрики и особь победителя
+        */
+        size_t count = racers.size();
+        atomic<int> stop{INT_MAX};
+        vector<IslandLink> links(count);
+        for (size_t k = 0; k < count; k++) {
+            links[k] = {nullptr, nullptr, &stop, 0, 1 + min_psnr / 10000}; // psnr входит в метрику как psnr/10000
+            racers[k]->island = &links[k];
+        }
+
+        uint64_t race_key = thread_rng()();
+        long long start_evaluations = obj.evaluations();
+        vector<pair<double, vector<double>>> results(count);
+        CostAccumulator* cost = current_cost();
+        // метаэвристика запускается, даже если гонка уже выиграна: она может достичь порога в том же
+        // или более раннем поколении, и без нее победитель зависел бы от загрузки потоков
+        run_concurrently(count, [&](size_t k) {
+            CostScope cost_scope(cost);
+            RandomStream racer_stream(mix64(race_key + k));
+            results[k] = racers[k]->optimize(obj);
+        });
+
+        size_t best = 0;
+        for (size_t k = 0; k < count; k++) {
+            racers[k]->island = nullptr;
+            if (links[k].won_generation != links[best].won_generation ? links[k].won_generation < links[best].won_generation
+                                                                      : results[k].first > results[best].first)
+                best = k;
+        }
+        stop_report = racers[best]->stop_report;
+        stop_report.evaluations = obj.evaluations() - start_evaluations;
+        stop_report.winner = names[best];
+        return results[best];
+    }
+};
+
+unique_ptr<Optimizer> make_portfolio(Population population, const OptimizerBudget& budget) {
+    // Гонка всех одиночных метаэвристик реестра
+    return make_unique<PORTFOLIO>(move(population), budget, vector<string>{"sca", "tlbo", "ica", "aoa", "ssa", "woa", "de"});
+}
+
+template <class Pixel>
+class BlockView{
+    /*
+    *   Блок 8x8 внутри изображения без копирования: указатель на левый верхний пиксель и шаг строки
+        Pixel - uint8_t (можно менять пиксели) или const uint8_t (только чтение)
+    */
+    private:
+    Pixel* origin;
+    size_t stride;
+
+    public:
+    BlockView(Pixel* origin, size_t stride) : origin(origin), stride(stride) {}
+
+    Pixel& operator()(int i, int j) const { return origin[i * stride + j]; }
+
+    void gather(PixelBlock& out) const {
+        // Копирование пикселей блока в построчный массив
+        for (int i = 0; i < BLOCK_SIZE; i++)
+            for (int j = 0; j < BLOCK_SIZE; j++)
+                out[i * BLOCK_SIZE + j] = origin[i * stride + j];
+    }
+
+    void scatter(const PixelBlock& in) const {
+        // Запись построчного массива в пиксели блока
+        for (int i = 0; i < BLOCK_SIZE; i++)
+            for (int j = 0; j < BLOCK_SIZE; j++)
+                origin[i * stride + j] = static_cast<uint8_t>(in[i * BLOCK_SIZE + j]);
+    }
+};
+
+// Расположение пикселей в буфере изображения
+enum ImageLayout {
+    LAYOUT_ROWS,  // построчно
+    LAYOUT_TILED  // поблочно: каждый блок 8x8 - 64 байта подряд (блоки в построчном порядке номеров)
+};
+
+class Image{
+    /*
+    *   Полутоновое изображение в одном непрерывном буфере, по байту на пиксель
+        Блоки нумеруются построчно: блок index начинается в строке 8 * (index / blocks_per_row()),
+        столбце 8 * (index % blocks_per_row())
+        В поблочном расположении блок занимает одну пару кеш-линий, поэтому обход блоков
+        в случайном порядке и сборка пакетов для DCT читают память подряд.
+        Поблочное расположение возможно только при размерах, кратных 8, иначе остается построчное
+    */
+    private:
+    int height = 0;
+    int width = 0;
+    ImageLayout layout = LAYOUT_ROWS;
+    vector<uint8_t> pixels;
+
+    size_t offset(int r, int c) const {
+        // Положение пикселя (r, c) в буфере
+        if (layout == LAYOUT_TILED)
+            return size_t((r / BLOCK_SIZE) * blocks_per_row() + c / BLOCK_SIZE) * BLOCK_AREA + (r % BLOCK_SIZE) * BLOCK_SIZE + c % BLOCK_SIZE;
+        return size_t(r) * width + c;
+    }
+
+    public:
+    Image() = default;
+    Image(int rows, int cols, ImageLayout layout = LAYOUT_ROWS)
+        : height(rows), width(cols), layout(rows % BLOCK_SIZE == 0 && cols % BLOCK_SIZE == 0 ? layout : LAYOUT_ROWS),
+          pixels(size_t(rows) * cols) {}
+
+    static Image read(const string& path, ImageLayout layout = LAYOUT_ROWS) {
+        // Чтение изображения в оттенках серого (пустое изображение, если файл не прочитался)
+        cv::Mat mat = cv::imread(path, cv::IMREAD_GRAYSCALE);
+        Image image(mat.rows, mat.cols, layout);
+        for (int r = 0; r < mat.rows; r++)
+            image.set_row(r, mat.ptr<uchar>(r));
+        return image;
+    }
+
+    bool write(const string& path) const {
+        cv::Mat mat(height, width, CV_8UC1);
+        for (int r = 0; r < height; r++)
+            get_row(r, mat.ptr<uchar>(r));
+        return cv::imwrite(path, mat);
+    }
+
+    void set_row(int r, const uint8_t* values) {
+        // Запись строки r из построчного массива
+        if (layout == LAYOUT_ROWS) {
+            copy(values, values + width, pixels.data() + offset(r, 0));
+            return;
+        }
+        for (int c = 0; c < width; c += BLOCK_SIZE) // в поблочном расположении строка разбита на куски по 8 пикселей
+            copy(values + c, values + c + BLOCK_SIZE, pixels.data() + offset(r, c));
+    }
+
+    void get_row(int r, uint8_t* values) const {
+        // Чтение строки r в построчный массив
+        if (layout == LAYOUT_ROWS) {
+            copy(pixels.data() + offset(r, 0), pixels.data() + offset(r, 0) + width, values);
+            return;
+        }
+        for (int c = 0; c < width; c += BLOCK_SIZE)
+            copy(pixels.data() + offset(r, c), pixels.data() + offset(r, c) + BLOCK_SIZE, values + c);
+    }
+
+    int rows() const { return height; }
+    int cols() const { return width; }
+    ImageLayout pixel_layout() const { return layout; }
+
+    uint8_t& at(int r, int c) { return pixels[offset(r, c)]; }
+    uint8_t at(int r, int c) const { return pixels[offset(r, c)]; }
+
+    int blocks_per_row() const { return width / BLOCK_SIZE; }
+    int block_count() const { return (height / BLOCK_SIZE) * blocks_per_row(); }
+
+    BlockView<uint8_t> block(int index) {
+        if (layout == LAYOUT_TILED)
+            return BlockView<uint8_t>(pixels.data() + size_t(index) * BLOCK_AREA, BLOCK_SIZE);
+        return BlockView<uint8_t>(&at(index / blocks_per_row() * BLOCK_SIZE, index % blocks_per_row() * BLOCK_SIZE), width);
+    }
+    BlockView<const uint8_t> block(int index) const {
+        if (layout == LAYOUT_TILED)
+            return BlockView<const uint8_t>(pixels.data() + size_t(index) * BLOCK_AREA, BLOCK_SIZE);
+        return BlockView<const uint8_t>(pixels.data() + offset(index / blocks_per_row() * BLOCK_SIZE, index % blocks_per_row() * BLOCK_SIZE), width);
+    }
+};
+
+double psnr(const Image& original_img, const Image& saved_img){
     /*
         Функция принимает на вход оригинальное изображение и изображение после вставки
         На выходе - значение метрики psnr
     */
     int sum_elem = 0;
-    for (int i = 0; i < original_img.size(); i++)
-        for (int j = 0; j < original_img[0].size(); j++)
-            sum_elem += pow(original_img[i][j] - saved_img[i][j],2);
+    for (int i = 0; i < original_img.rows(); i++)
+        for (int j = 0; j < original_img.cols(); j++)
+            sum_elem += pow(original_img.at(i, j) - saved_img.at(i, j),2);
         
     double psnr = 10 * log10(pow(255,4) / double(sum_elem));
     return psnr;
 }
 
-double ssim(vector<vector<int>> original_img,vector<vector<int>> saved_img){
+double ssim(const Image& original_img, const Image& saved_img){
     /*
         Функция принимает на вход оригинальное изображение и изображение после вставки
         На выходе - значение метрики ssim
     */
+    size_t size = original_img.rows();
     double mean1 = 0, mean2 = 0;
-    for (int i = 0; i < original_img.size(); i++){
-        for (int j = 0; j < original_img[0].size(); j++){
-            mean1 += original_img[i][j];
-            mean2 += saved_img[i][j];
+    for (int i = 0; i < original_img.rows(); i++){
+        for (int j = 0; j < original_img.cols(); j++){
+            mean1 += original_img.at(i, j);
+            mean2 += saved_img.at(i, j);
         }
     }
-    mean1 /= ((original_img.size()*original_img.size())*3);
-    mean2 /= ((original_img.size()*original_img.size())*3);
+    mean1 /= ((size*size)*3);
+    mean2 /= ((size*size)*3);
 
     double sd1 = 0, sd2 = 0, cov = 0;
 
 
-    for (int i = 0; i < original_img.size(); i++){
-        for (int j = 0; j < original_img[0].size(); j++){
-            sd1 += (original_img[i][j]/3 - mean1) * (original_img[i][j]/3 - mean1);
-            sd2 += (saved_img[i][j]/3 - mean2) * (saved_img[i][j]/3 - mean2);
-            cov += (original_img[i][j] / 3 - mean1) * (saved_img[i][j] / 3 - mean2);
+    for (int i = 0; i < original_img.rows(); i++){
+        for (int j = 0; j < original_img.cols(); j++){
+            int original = original_img.at(i, j), saved = saved_img.at(i, j);
+            sd1 += (original/3 - mean1) * (original/3 - mean1);
+            sd2 += (saved/3 - mean2) * (saved/3 - mean2);
+            cov += (original / 3 - mean1) * (saved / 3 - mean2);
         }
     }
     
-    cov /= (original_img.size()*original_img.size());
-    sd1 = pow((sd1 / (original_img.size()*original_img.size())),0.5);
-    sd2 = pow((sd2 / (original_img.size()*original_img.size())),0.5);
+    cov /= (size*size);
+    sd1 = pow((sd1 / (size*size)),0.5);
+    sd2 = pow((sd2 / (size*size)),0.5);
 
     double c1 = pow(0.01*255,2), c2 = pow(0.03*255,2);
     return ((2 * mean1 * mean2 + c1) * (2 * cov + c2)) / (
@@ -1177,7 +3285,952 @@ double ssim(vector<vector<int>> original_img,vector<vector<int>> saved_img){
 }
 
 
-int main() {
+struct EmbeddabilityThresholds{
+    /*
+    *   Пороги предсказателя embeddable: блок, в который проекция порцию не встроила,
+        не отдается метаэвристике, а сразу получает бит-флаг 0, если
+        выход пикселей за [0, 255] после сдвига встраиваемых коэффициентов больше max_overflow
+        или доля пикселей, равных 0 или 255, не меньше max_saturated
+    */
+    bool enabled = false;
+    double max_overflow = 28; // сумма выхода пикселей за [0, 255] по блоку
+    double max_saturated = 1.0;
+};
+
+struct EmbedContext{
+    /*
+    *   Параметры встраивания в одну картинку, общие для всех ее блоков
+    */
+    const Image* img; // изначальное изображение
+    string method; // "spatial" или "frequency"
+    string metaheuristic;
+    OptimizerFactory optimizer; // метаэвристика metaheuristic из реестра
+    MetricFactory make_metric; // метрика для области встраивания method
+    int search_space;
+    uint64_t seed; // seed эксперимента
+    uint64_t picture_key; // хеш имени картинки
+    StopCriteria stop; // условия досрочной остановки метаэвристики
+    size_t cache_entries; // размер кэша оценок метрики каждого блока (0 - без кэша)
+    bool incremental; // инкрементальная оценка потомков, отличающихся от родителя в немногих значениях
+    double screening_ratio; // доля кандидатов, оцениваемых полностью после отсева по предсказанию (1 - без отсева)
+    int projection_steps; // шаги быстрого пути project_block перед метаэвристикой (0 - без быстрого пути)
+    EmbeddabilityThresholds embeddability; // предсказание блоков, которые метаэвристике отдавать бесполезно
+};
+
+// Номер порции для блока, в который встраивается только бит-флаг 0
+const size_t NO_CHUNK = SIZE_MAX;
+
+struct BlockResult{
+    /*
+    *   Результат встраивания в один блок
+    */
+    bool computed = false; // блок уже обрабатывался
+    size_t chunk = NO_CHUNK; // номер порции информации (по 31 биту), которую пытались встроить
+    bool embedded = false; // значение метрики > 1 - порция встроена идеально
+    bool payload_projected = false; // порция встроена быстрым путем project_block, без метаэвристики
+    bool optimized = false; // порция оптимизировалась метаэвристикой (optimize_block)
+    bool skipped = false; // по предсказанию embeddable порция не оптимизировалась метаэвристикой
+    bool flag_projected = false; // бит-флаг 0 встроен быстрым путем, без SCA
+    double fitness = 0;
+    StopReport stop; // итог оптимизации порции (без встраивания бита-флага)
+    Cost cost; // затраты на блок, включая встраивание бита-флага
+    vector<double> solution; // итоговая матрица изменений (при неудаче - для бита-флага 0)
+    PixelBlock pixels; // блок, который записывается в изображение
+};
+
+vector<vector<int>> get_block(const Image& img, int block) {
+    //получаем блок изображения по известному номера блока
+    BlockView<const uint8_t> view = img.block(block);
+    vector<vector<int>> pixel_matrix(8, vector<int>(8));
+    for (int i1 = 0; i1 < 8; i1++)
+        for (int i2 = 0; i2 < 8; i2++)
+            pixel_matrix[i1][i2] = view(i1, i2);
+    return pixel_matrix;
+}
+
+PixelBlock apply_solution(const vector<vector<int>>& pixel_matrix, const vector<double>& solution, const string& method) {
+    // Блок, который получается после добавления к исходному матрицы изменений
+    PhaseTimer timer(PHASE_DCT);
+    PixelBlock new_block;
+    if (method == "frequency"){
+        Block dct_coef_block;
+        dct_8x8(flatten_block(pixel_matrix), dct_coef_block);
+        for (int i = 0; i < BLOCK_AREA; i++)
+            dct_coef_block[i] -= solution[i];
+        idct_8x8(dct_coef_block, new_block);
+    }
+    else{
+        new_block = flatten_block(pixel_matrix);
+        for (int i = 0; i < BLOCK_AREA; i++)
+            new_block[i] -= solution[i];
+    }
+    return new_block;
+}
+
+Population initial_population(const vector<vector<int>>& pixel_matrix, uint32_t payload, char mode, int search_space, const string& method) {
+    // Встраивание порции в DCT-coef блока и генерация начальной популяции вокруг полученной матрицы изменений
+    vector<vector<double>> dct_matrix, dct_matrix_new;
+    vector<vector<int>> new_pixel_matrix;
+    {
+        PhaseTimer timer(PHASE_DCT);
+        dct_matrix = do_dct(pixel_matrix);
+        dct_matrix_new = embed_to_dct(dct_matrix, payload, mode);
+        if (method == "spatial") //перевод блока из DCT-coef в пиксельный формат
+            new_pixel_matrix = undo_dct(dct_matrix_new);
+    }
+    PhaseTimer timer(PHASE_POPULATION);
+    if (method == "spatial")
+        return generate_population(pixel_matrix, new_pixel_matrix, 128, double(0.9), search_space);
+    return generate_population_dct(dct_matrix, dct_matrix_new, 128, double(0.9), search_space);
+}
+
+pair<double, vector<double>> project_block(const EmbedContext& ctx, const vector<vector<int>>& pixel_matrix, uint32_t payload,
+                                           char mode, int search_space) {
+    /*
+    *   Быстрый путь встраивания без метаэвристики - проекция на блоки, из которых извлекается порция
+        Встраиваемые DCT-coef сдвигаются в интервалы своих бит (project_to_bits), коэффициенты переводятся в пиксели
+        (округление и ограничение [0, 255]), от пикселей снова берется DCT и встраиваемые коэффициенты
+        снова сдвигаются; так до ctx.projection_steps шагов, пока из пикселей не извлекается вся порция
+        Найденная матрица изменений проверяется метрикой блока, поэтому значение качества
+        и преобразованная особь такие же, как у решения метаэвристики
+        Возвращает значение метрики (0, если проекция не сошлась или вышла за пространство поиска) и матрицу изменений
+    */
+    PhaseTimer timer(PHASE_PROJECT);
+    const double q = 8;
+    PixelBlock original = flatten_block(pixel_matrix), pixels;
+    Block dct_original, coefs, dct_pixels;
+    dct_8x8(original, dct_original);
+    coefs = dct_original;
+    project_to_bits(coefs, payload, mode, q);
+
+    bool converged = false;
+    for (int step = 0; step < ctx.projection_steps; step++) {
+        idct_8x8(coefs, pixels);
+        for (int& pixel : pixels)
+            pixel = clamp(pixel, 0, 255);
+        dct_8x8(pixels, dct_pixels);
+        uint32_t extracted;
+        int length = extracting_dct(dct_pixels, extracted, q);
+        converged = (mode == 'A') ? (length == EMBED_BITS && extracted == payload) : length == 1;
+        if (converged)
+            break;
+        coefs = dct_pixels;
+        project_to_bits(coefs, payload, mode, q);
+    }
+    if (!converged)
+        return make_pair(0.0, vector<double>());
+
+    vector<double> candidate(BLOCK_AREA);
+    for (int i = 0; i < BLOCK_AREA; i++) {
+        candidate[i] = (ctx.method == "frequency") ? dct_original[i] - coefs[i] : double(original[i] - pixels[i]);
+        if (abs(candidate[i]) > search_space) // метаэвристика такую матрицу изменений получить не может
+            return make_pair(0.0, vector<double>());
+    }
+    unique_ptr<Metric> metric = ctx.make_metric(pixel_matrix, payload, search_space, mode);
+    vector<double> repaired(BLOCK_AREA);
+    double fitness = metric->evaluate(candidate.data(), repaired.data());
+    return make_pair(fitness, repaired);
+}
+
+bool embeddable(const vector<vector<int>>& pixel_matrix, uint32_t payload, const EmbeddabilityThresholds& thresholds,
+                double* overflow_ret = nullptr) {
+    /*
+    *   Предсказание по статистике блока, можно ли встроить в него порцию payload
+        Встраиваемые DCT-coef сдвигаются в интервалы своих бит (project_to_bits - сдвиг зависит от величины
+        коэффициентов относительно шага q), изменение переводится в пиксели одним обратным DCT;
+        то, насколько пиксели выходят за [0, 255], метаэвристика компенсировать не успевает
+        В overflow_ret (если задан) записывается выход пикселей за [0, 255]
+    */
+    PixelBlock pixels = flatten_block(pixel_matrix);
+    Block dct_block, shift, pixel_shift;
+    dct_8x8(pixels, dct_block);
+    shift = dct_block;
+    project_to_bits(shift, payload);
+    for (int i = 0; i < BLOCK_AREA; i++)
+        shift[i] -= dct_block[i];
+    idct_8x8(shift.data(), pixel_shift.data());
+
+    double overflow = 0;
+    int saturated = 0;
+    for (int i = 0; i < BLOCK_AREA; i++) {
+        double value = pixels[i] + pixel_shift[i];
+        overflow += max(0.0, value - 255) + max(0.0, -value);
+        saturated += pixels[i] == 0 || pixels[i] == 255;
+    }
+    if (overflow_ret)
+        *overflow_ret = overflow;
+    return overflow <= thresholds.max_overflow && saturated < thresholds.max_saturated * BLOCK_AREA;
+}
+
+pair<double, vector<double>> optimize_block(const EmbedContext& ctx, const vector<vector<int>>& pixel_matrix, uint32_t payload, int iterations,
+                                            const StopCriteria& stop, StopReport* report = nullptr) {
+    /*
+    *   Встраивание payload в блок выбранной метаэвристикой
+        iterations - число итераций метаэвристики, stop - условия досрочной остановки
+        Возвращает значение метрики и матрицу изменений, в report записывается итог оптимизации
+    */
+    Population population = initial_population(pixel_matrix, payload, 'A', ctx.search_space, ctx.method);
+
+    //задаем объект метрики для данного блока и информации для встраивания
+    unique_ptr<Metric> metric = ctx.make_metric(pixel_matrix, payload, ctx.search_space, 'A');
+    if (ctx.cache_entries)
+        metric->enable_cache(ctx.cache_entries);
+    if (ctx.incremental)
+        metric->enable_incremental();
+    metric->enable_screening(ctx.screening_ratio);
+    //оптимизация выбранной метаэвристикой
+    OptimizerBudget budget;
+    budget.population_size = population.size();
+    budget.num_iterations = iterations;
+    budget.searching = ctx.search_space;
+    budget.stop = stop;
+    unique_ptr<Optimizer> optimizer = create_optimizer(ctx.optimizer, move(population), budget);
+    PhaseTimer timer(PHASE_OPTIMIZE);
+    pair<double, vector<double>> solution = optimizer->optimize(*metric);
+    if (report)
+        *report = optimizer->stop_report;
+    return solution;
+}
+
+BlockResult embed_block(const EmbedContext& ctx, int block, size_t chunk, const BitVector& information) {
+    /*
+    *   Встраивание порции информации номер chunk в блок номер block
+        Если порцию встроить не удалось или chunk == NO_CHUNK, в блок встраивается бит-флаг 0
+        Результат зависит только от блока и порции, поэтому блоки можно обрабатывать в любом порядке и параллельно
+    */
+    CostAccumulator block_cost;
+    CostScope cost_scope(&block_cost);
+    BlockResult result;
+    result.computed = true;
+    result.chunk = chunk;
+    vector<vector<int>> pixel_matrix = get_block(*ctx.img, block);
+
+    if (chunk != NO_CHUNK) {
+        // случайные числа блока зависят только от seed, картинки, номера блока и метаэвристики
+        RandomStream block_stream(stream_key(ctx.seed, ctx.picture_key, block, hash_name(ctx.metaheuristic)));
+        //встраивание информации в DCT-coef блок: бит-флаг 1 и 31 бит информации
+        uint32_t payload = EMBED_FLAG | information.chunk(chunk * 31, 31);
+        pair<double, vector<double>> solution = project_block(ctx, pixel_matrix, payload, 'A', ctx.search_space);
+        result.payload_projected = solution.first > 1;
+        if (result.payload_projected) {
+            result.stop.evaluations = 1;
+            result.stop.reason = "projection";
+        }
+        else if (ctx.embeddability.enabled && !embeddable(pixel_matrix, payload, ctx.embeddability)) {
+            result.skipped = true; // порцию не встроить - сразу бит-флаг 0
+            result.stop.reason = "predicted";
+        }
+        else { // быстрый путь не сошелся - оптимизация выбранной метаэвристикой
+            result.optimized = true;
+            solution = optimize_block(ctx, pixel_matrix, payload, 128, ctx.stop, &result.stop);
+        }
+        result.fitness = solution.first;
+        if (solution.first > 1) { // значение кач-ва метрики >1 => информация встроена идеально, сохраняем новый блок, добавляя к нему матрицу изменений
+            result.embedded = true;
+            result.solution = solution.second;
+            result.pixels = apply_solution(pixel_matrix, solution.second, ctx.method);
+            result.cost = block_cost.snapshot();
+            return result;
+        }
+    }
+
+    // информация встроена неидеально - встраиваем 1 бит - 0
+    RandomStream flag_stream(stream_key(ctx.seed, ctx.picture_key, block, hash_name("flag")));
+    int searching = 5;
+    pair<double, vector<double>> flag_solution = project_block(ctx, pixel_matrix, 0, 'Z', searching);
+    result.flag_projected = flag_solution.first > 1;
+    if (result.flag_projected) {
+        result.solution = flag_solution.second;
+        result.pixels = apply_solution(pixel_matrix, result.solution, ctx.method);
+        result.cost = block_cost.snapshot();
+        return result;
+    }
+    Population population = initial_population(pixel_matrix, 0, 'Z', searching, ctx.method);
+
+    //создание объекта метрики, с учетом встраивание 1 бита
+    unique_ptr<Metric> flag_metric = ctx.make_metric(pixel_matrix, 0, searching, 'Z');
+    if (ctx.cache_entries)
+        flag_metric->enable_cache(ctx.cache_entries);
+
+    // оптимизация с помощью метаэвристики SCA
+    SCA sca(move(population), 128, 128, 64);
+    {
+        PhaseTimer timer(PHASE_OPTIMIZE);
+        result.solution = sca.optimize(*flag_metric, 1).second;
+    }
+    //сохраняем блок, в который не встраивалась информация
+    result.pixels = apply_solution(pixel_matrix, result.solution, ctx.method);
+    result.cost = block_cost.snapshot();
+    return result;
+}
+
+vector<char> predict_carriers(const EmbedContext& ctx, const vector<int>& blocks, const BitVector& information, ThreadPool& pool, int probe_iterations) {
+    /*
+    *   Предварительный проход: какие блоки смогут нести информацию
+        Каждый блок независимо оптимизируется с коротким бюджетом probe_iterations итераций,
+        с порцией, которую он получил бы, если бы все предыдущие блоки встроились
+        На выходе 1 для блоков, в которые порцию удалось встроить идеально
+    */
+    vector<char> carriers(blocks.size());
+    CostAccumulator* cost = current_cost();
+    pool.parallel_for(blocks.size(), [&](size_t k) {
+        CostScope cost_scope(cost);
+        RandomStream probe_stream(stream_key(ctx.seed, ctx.picture_key, blocks[k], hash_name(ctx.metaheuristic), hash_name("probe")));
+        vector<vector<int>> pixel_matrix = get_block(*ctx.img, blocks[k]);
+        uint32_t payload = EMBED_FLAG | information.chunk(k * 31, 31);
+        StopCriteria probe_stop;
+        probe_stop.target_fitness = 1; // для предсказания достаточно идеального встраивания
+        carriers[k] = project_block(ctx, pixel_matrix, payload, 'A', ctx.search_space).first > 1
+                   || optimize_block(ctx, pixel_matrix, payload, probe_iterations, probe_stop).first > 1;
+    });
+    return carriers;
+}
+
+vector<BlockResult> embed_blocks(const EmbedContext& ctx, const vector<int>& blocks, const BitVector& information, ThreadPool& pool,
+                                 const vector<char>* carriers = nullptr, Cost* discarded = nullptr) {
+    /*
+    *   Параллельное встраивание информации во все блоки картинки
+        Блоку k достается следующая порция информации, только если все предыдущие (в порядке blocks)
+        порции встроились, поэтому блоки обрабатываются спекулятивно: для окна из следующих блоков
+        предполагается, что все предыдущие встраивания удались, и блоки окна оптимизируются параллельно.
+        Затем результаты принимаются по порядку; как только предположение о порции не подтвердилось,
+        оставшиеся блоки оптимизируются заново уже с верной порцией.
+        carriers - заранее выбранные блоки-носители (predict_carriers): остальным блокам
+        сразу встраивается бит-флаг 0, а предположение о порциях делается только по носителям.
+        Без carriers итог совпадает с последовательной обработкой при любом числе потоков
+        В discarded добавляются затраты на результаты, которые пришлось пересчитать
+    */
+    vector<BlockResult> results(blocks.size());
+    const size_t window = 4 * pool.size(); // сколько блоков обрабатывается наперед
+    size_t resolved = 0; // блоки до resolved приняты окончательно
+    size_t cursor = 0; // номер порции информации для блока resolved
+    vector<size_t> expected(blocks.size()); // предполагаемая порция для блоков окна
+
+    while (resolved < blocks.size()) {
+        size_t end = min(blocks.size(), resolved + window);
+        // блоки окна, у которых нет результата для предполагаемой порции
+        vector<size_t> tasks;
+        size_t chunk = cursor;
+        for (size_t k = resolved; k < end; k++) {
+            expected[k] = (carriers == nullptr || (*carriers)[k]) ? chunk++ : NO_CHUNK;
+            if (!results[k].computed || results[k].chunk != expected[k]) {
+                if (results[k].computed && discarded)
+                    *discarded += results[k].cost;
+                tasks.push_back(k);
+            }
+        }
+
+        auto run_block = [&](size_t t) {
+            size_t k = tasks[t];
+            results[k] = embed_block(ctx, blocks[k], expected[k], information);
+        };
+        if (tasks.size() >= pool.size())
+            pool.parallel_for(tasks.size(), run_block);
+        else // блоков меньше, чем потоков - блоки по очереди, а пул оценивает популяцию внутри блока
+            for (size_t t = 0; t < tasks.size(); t++)
+                run_block(t);
+
+        // принимаем результаты по порядку, пока порция совпадает с предположением
+        // (блоки без порции от предположений не зависят)
+        while (resolved < end && (results[resolved].chunk == cursor || results[resolved].chunk == NO_CHUNK)) {
+            if (results[resolved].embedded)
+                cursor++; // переход к следующей части информации
+            resolved++;
+        }
+    }
+    return results;
+}
+
+struct BlockCost{
+    // Затраты на один блок для отчета
+    int block;
+    bool embedded;
+    bool projected; // порция встроена быстрым путем, без метаэвристики
+    bool optimized; // порция оптимизировалась метаэвристикой
+    bool skipped; // порция не оптимизировалась по предсказанию embeddable
+    bool flag_projected; // бит-флаг 0 встроен быстрым путем
+    double fitness;
+    int generations;
+    Cost cost;
+    string winner; // победитель гонки портфеля (пусто - без гонки)
+};
+
+struct PictureCost{
+    /*
+    *   Затраты на встраивание в одну картинку одной метаэвристикой
+    */
+    string metaheuristic;
+    string picture;
+    int embedded = 0; // блоков с идеально встроенной порцией
+    int projected = 0; // блоков, порция которых встроена быстрым путем
+    int optimized = 0; // блоков, порция которых оптимизировалась метаэвристикой
+    int skipped = 0; // блоков, сразу получивших бит-флаг 0 по предсказанию embeddable
+    int no_payload = 0; // блоков без порции (не носители по predict_carriers); с projected, optimized и skipped - все блоки
+    int flag_projected = 0; // блоков, бит-флаг 0 которых встроен быстрым путем
+    long long evaluations_avoided = 0; // верхняя граница числа оценок особей, которые метаэвристика потратила бы на пропущенные блоки
+    double wall_ms = 0; // время встраивания в картинку
+    Cost total; // все затраты, включая пересчитанные блоки
+    Cost discarded; // затраты на результаты блоков, которые пришлось пересчитать
+    vector<BlockCost> blocks;
+};
+
+string json_string(const string& value) {
+    // Строка в кавычках для JSON: кавычки, обратная косая черта и управляющие символы экранируются
+    string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            result += "\\u00";
+            result += "0123456789abcdef"[c >> 4];
+            result += "0123456789abcdef"[c & 15];
+        }
+        else
+            result += c;
+    }
+    return result + '"';
+}
+
+void write_cost_json(ostream& out, const Cost& cost) {
+    out << "{\"evaluations\": " << cost.evaluations << ", \"dct\": " << cost.dct << ", \"idct\": " << cost.idct
+        << ", \"cache_hits\": " << cost.cache_hits << ", \"incremental\": " << cost.incremental
+        << ", \"screened\": " << cost.screened;
+    for (int i = 0; i < PHASE_COUNT; i++)
+        out << ", \"" << PHASE_NAMES[i] << "_us\": " << cost.phase_us[i];
+    out << "}";
+}
+
+void write_cost_report(const string& path, uint64_t seed, const vector<PictureCost>& reports) {
+    /*
+        Отчет о затратах за запуск: path.csv - строка на каждый блок,
+        path.json - итоги по картинкам и по метаэвристикам, включая затраты на один встроенный блок
+    */
+    ofstream csv(path + ".csv");
+    csv << "metaheuristic,picture,block,embedded,projected,optimized,skipped,flag_projected,fitness,generations,evaluations,dct,idct,cache_hits,incremental,screened,winner";
+    for (int i = 0; i < PHASE_COUNT; i++)
+        csv << ',' << PHASE_NAMES[i] << "_us";
+    csv << '\n';
+    for (const PictureCost& report : reports)
+        for (const BlockCost& block : report.blocks) {
+            csv << report.metaheuristic << ',' << report.picture << ',' << block.block << ',' << block.embedded << ','
+                << block.projected << ',' << block.optimized << ',' << block.skipped << ',' << block.flag_projected << ','
+                << block.fitness << ',' << block.generations << ',' << block.cost.evaluations << ',' << block.cost.dct << ','
+                << block.cost.idct << ',' << block.cost.cache_hits << ',' << block.cost.incremental << ',' << block.cost.screened
+                << ',' << block.winner;
+            for (int i = 0; i < PHASE_COUNT; i++)
+                csv << ',' << block.cost.phase_us[i];
+            csv << '\n';
+        }
+
+    // итоги по метаэвристикам в порядке первого появления
+    vector<string> names;
+    map<string, PictureCost> totals;
+    map<string, size_t> block_counts;
+    for (const PictureCost& report : reports) {
+        if (!totals.count(report.metaheuristic))
+            names.push_back(report.metaheuristic);
+        PictureCost& total = totals[report.metaheuristic];
+        total.embedded += report.embedded;
+        total.projected += report.projected;
+        total.optimized += report.optimized;
+        total.skipped += report.skipped;
+        total.no_payload += report.no_payload;
+        total.flag_projected += report.flag_projected;
+        total.evaluations_avoided += report.evaluations_avoided;
+        total.wall_ms += report.wall_ms;
+        total.total += report.total;
+        total.discarded += report.discarded;
+        block_counts[report.metaheuristic] += report.blocks.size();
+    }
+
+    ofstream json(path + ".json");
+    json << "{\n  \"seed\": " << seed << ",\n  \"pictures\": [";
+    for (size_t r = 0; r < reports.size(); r++) {
+        const PictureCost& report = reports[r];
+        json << (r ? ",\n" : "\n") << "    {\"metaheuristic\": " << json_string(report.metaheuristic) << ", \"picture\": " << json_string(report.picture)
+             << ", \"blocks\": " << report.blocks.size() << ", \"embedded\": " << report.embedded
+             << ", \"projected\": " << report.projected << ", \"optimized\": " << report.optimized
+             << ", \"skipped\": " << report.skipped << ", \"no_payload\": " << report.no_payload
+             << ", \"flag_projected\": " << report.flag_projected
+             << ", \"evaluations_avoided\": " << report.evaluations_avoided
+             << ", \"wall_ms\": " << report.wall_ms << ",\n     \"wins\": {";
+        // сколько блоков выиграла каждая метаэвристика портфеля
+        map<string, int> wins;
+        for (const BlockCost& block : report.blocks)
+            if (!block.winner.empty())
+                wins[block.winner]++;
+        for (auto it = wins.begin(); it != wins.end(); ++it)
+            json << (it == wins.begin() ? "" : ", ") << json_string(it->first) << ": " << it->second;
+        json << "},\n     \"cost\": ";
+        write_cost_json(json, report.total);
+        json << ",\n     \"discarded\": ";
+        write_cost_json(json, report.discarded);
+        json << "}";
+    }
+    json << "\n  ],\n  \"metaheuristics\": [";
+    for (size_t m = 0; m < names.size(); m++) {
+        const PictureCost& total = totals[names[m]];
+        double embedded = max(total.embedded, 1);
+        json << (m ? ",\n" : "\n") << "    {\"metaheuristic\": " << json_string(names[m]) << ", \"blocks\": " << block_counts[names[m]]
+             << ", \"embedded\": " << total.embedded << ", \"projected\": " << total.projected
+             << ", \"optimized\": " << total.optimized << ", \"skipped\": " << total.skipped
+             << ", \"no_payload\": " << total.no_payload << ", \"flag_projected\": " << total.flag_projected
+             << ", \"evaluations_avoided\": " << total.evaluations_avoided << ", \"wall_ms\": " << total.wall_ms
+             << ", \"evaluations_per_embedded\": " << total.total.evaluations / embedded
+             << ", \"optimize_us_per_embedded\": " << total.total.phase_us[PHASE_OPTIMIZE] / embedded
+             << ", \"cache_hit_rate\": " << double(total.total.cache_hits) / max(total.total.evaluations, 1LL) << ",\n     \"cost\": ";
+        write_cost_json(json, total.total);
+        json << "}";
+    }
+    json << "\n  ]\n}\n";
+}
+
+vector<vector<int>> benchmark_block(mt19937& gen) {
+    // Случайный блок для замеров: плавный градиент с шумом, как в обычных фотографиях
+    uniform_int_distribution<int> base_dist(30, 220), slope_dist(-4, 4), noise_dist(-6, 6);
+    int base = base_dist(gen), dx = slope_dist(gen), dy = slope_dist(gen);
+    vector<vector<int>> block(8, vector<int>(8));
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            block[i][j] = clamp(base + dx * i + dy * j + noise_dist(gen), 0, 255);
+    return block;
+}
+
+vector<vector<int>> saturated_block(mt19937& gen) {
+    // Блок у границы диапазона: темная или светлая область, часть пикселей равна 0 или 255
+    uniform_int_distribution<int> base_dist(0, 30), slope_dist(-3, 3), noise_dist(-6, 6);
+    int base = base_dist(gen), dx = slope_dist(gen), dy = slope_dist(gen);
+    bool bright = gen() & 1;
+    vector<vector<int>> block(8, vector<int>(8));
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++) {
+            int value = clamp(base + dx * i + dy * j + noise_dist(gen), 0, 255);
+            block[i][j] = bright ? 255 - value : value;
+        }
+    return block;
+}
+
+int run_benchmark() {
+    /*
+        Замер скорости подсчета метрики (запуск: main bench)
+        Для каждого способа встраивания берутся случайные блоки и популяции, как в основном цикле,
+        выводится среднее время одной оценки особи в микросекундах
+        Возвращает 1, если не прошла какая-то из проверок (расхождение DCT с cv::dct)
+    */
+    const int NUM_BLOCKS = 64;
+    const int POPULATION = 128;
+    const int REPEATS = 4;
+    vector<string> methods{"spatial", "frequency"};
+    int status = 0;
+
+    // Проверка собственного DCT 8x8 по cv::dct / cv::idct на тех же блоках
+    {
+        const double DCT_TOLERANCE = 1e-9;
+        mt19937 gen(2023);
+        double max_forward = 0, max_inverse = 0;
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            PixelBlock pixels = flatten_block(benchmark_block(gen));
+            cv::Mat mat(BLOCK_SIZE, BLOCK_SIZE, CV_64FC1), reference, inverse;
+            for (int i = 0; i < BLOCK_AREA; i++)
+                mat.at<double>(i / BLOCK_SIZE, i % BLOCK_SIZE) = pixels[i];
+            cv::dct(mat, reference);
+            cv::idct(reference, inverse);
+            Block coefs, back;
+            dct_8x8(pixels, coefs);
+            idct_8x8(coefs.data(), back.data());
+            for (int i = 0; i < BLOCK_AREA; i++) {
+                max_forward = max(max_forward, abs(coefs[i] - reference.at<double>(i / BLOCK_SIZE, i % BLOCK_SIZE)));
+                max_inverse = max(max_inverse, abs(back[i] - inverse.at<double>(i / BLOCK_SIZE, i % BLOCK_SIZE)));
+            }
+        }
+        cout << "dct vs cv::dct: max abs diff " << max_forward << ", idct vs cv::idct: " << max_inverse << '\n';
+        if (max_forward > DCT_TOLERANCE || max_inverse > DCT_TOLERANCE) {
+            cout << "error: dct_8x8 differs from cv::dct by more than " << DCT_TOLERANCE << '\n';
+            status = 1;
+        }
+    }
+
+    for (const string& method : methods) {
+        mt19937 gen(2023);
+        RandomStream stream(stream_key(2023, hash_name(method), 0, 0)); // одинаковые популяции при каждом запуске
+        double total_us = 0, batch_us = 0;
+        long long evaluations = 0;
+        double checksum = 0;
+        bool same = true; // пакетная оценка (evaluate_batch) совпадает с оценкой по одной
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            vector<vector<int>> pixel_matrix = benchmark_block(gen);
+            uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+            vector<vector<double>> dct_matrix = do_dct(pixel_matrix);
+            vector<vector<double>> dct_matrix_new = embed_to_dct(dct_matrix, bits);
+            Population population = method == "spatial"
+                ? generate_population(pixel_matrix, undo_dct(dct_matrix_new), POPULATION, 0.9, 10)
+                : generate_population_dct(dct_matrix, dct_matrix_new, POPULATION, 0.9, 10);
+            unique_ptr<Metric> metric = find_metric(method)(pixel_matrix, bits, 10, 'A');
+            vector<double> repaired(population.dimensions()), fitness(population.size());
+
+            auto start = chrono::steady_clock::now();
+            for (int r = 0; r < REPEATS; r++)
+                for (size_t a = 0; a < population.size(); a++) {
+                    fitness[a] = metric->evaluate(population[a], repaired.data());
+                    checksum += fitness[a];
+                }
+            total_us += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            evaluations += REPEATS * population.size();
+
+            for (int r = 0; r < REPEATS; r++) {
+                Population batch = population;
+                auto batch_start = chrono::steady_clock::now();
+                metric->evaluate_batch(batch, 0, batch.size());
+                batch_us += chrono::duration<double, micro>(chrono::steady_clock::now() - batch_start).count();
+                same = same && equal(fitness.begin(), fitness.end(), batch.fitness());
+            }
+        }
+        cout << method << ": " << total_us / evaluations << " us/eval, batched " << batch_us / evaluations << " us/eval ("
+             << evaluations << " evals, checksum " << checksum << ")\n";
+        if (!same) {
+            cout << "error: evaluate_batch differs from evaluate for " << method << '\n';
+            status = 1;
+        }
+    }
+    // Сборка блоков 512x512 изображения в случайном порядке для построчного и поблочного расположения
+    for (ImageLayout layout : {LAYOUT_ROWS, LAYOUT_TILED}) {
+        mt19937 gen(2023);
+        Image image(512, 512, layout);
+        for (int r = 0; r < image.rows(); r++)
+            for (int c = 0; c < image.cols(); c++)
+                image.at(r, c) = uint8_t(gen());
+        vector<int> order(image.block_count());
+        iota(order.begin(), order.end(), 0);
+        shuffle(order.begin(), order.end(), gen);
+        const int GATHER_REPEATS = 50;
+        long long checksum = 0;
+        PixelBlock block;
+        auto start = chrono::steady_clock::now();
+        for (int r = 0; r < GATHER_REPEATS; r++)
+            for (int index : order) {
+                image.block(index).gather(block);
+                checksum += block[r % BLOCK_AREA];
+            }
+        double total_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        cout << (layout == LAYOUT_TILED ? "tiled" : "rows") << " gather: " << total_ns / (GATHER_REPEATS * order.size())
+             << " ns/block (checksum " << checksum << ")\n";
+    }
+
+    // Функции обновления особей: скалярный вариант и выбранный для процессора на одной и той же популяции
+    {
+        const int ROWS = 128, KERNEL_REPEATS = 2000;
+        RandomStream stream(stream_key(2023, hash_name("kernels"), 0, 0));
+        Population agents(ROWS, BLOCK_AREA);
+        for (int i = 0; i < ROWS; i++)
+            fill_uniform(agents[i], BLOCK_AREA, -10, 10);
+        vector<double> mean(BLOCK_AREA), random(2 * BLOCK_AREA);
+        agents.mean(mean.data());
+        fill_uniform(random.data(), random.size(), 0, 1);
+        auto time_kernel = [&](const char* name, auto run) {
+            double ns[2];
+            Population results[2] = {Population(ROWS, BLOCK_AREA), Population(ROWS, BLOCK_AREA)};
+            const UpdateKernels* kernels[2] = {&UPDATE_KERNELS_SCALAR, &UPDATE_KERNELS};
+            for (int k = 0; k < 2; k++) {
+                auto start = chrono::steady_clock::now();
+                for (int r = 0; r < KERNEL_REPEATS; r++)
+                    for (int i = 0; i < ROWS; i++)
+                        run(*kernels[k], i, results[k][i]);
+                ns[k] = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (KERNEL_REPEATS * ROWS);
+            }
+            bool same = equal(results[0][0], results[0][0] + ROWS * BLOCK_AREA, results[1][0]);
+            cout << name << ": scalar " << ns[0] << " ns/row, selected " << ns[1] << " ns/row"
+                 << (same ? "" : " (results differ)") << '\n';
+        };
+        time_kernel("axpy", [&](const UpdateKernels& k, int i, double* out) { k.axpy(0.5, agents[i], out, BLOCK_AREA); });
+        time_kernel("clamp", [&](const UpdateKernels& k, int, double* out) { k.clamp(out, BLOCK_AREA, -10, 10); });
+        time_kernel("teacher", [&](const UpdateKernels& k, int i, double* out) {
+            k.teacher(agents[0], mean.data(), agents[i], random.data(), out, BLOCK_AREA); });
+        time_kernel("learner", [&](const UpdateKernels& k, int i, double* out) {
+            k.learner(agents[1], agents[2], agents[i], random.data(), out, BLOCK_AREA); });
+        time_kernel("encircle", [&](const UpdateKernels& k, int i, double* out) { k.encircle(agents[0], agents[i], 0.7, 1.3, out, BLOCK_AREA); });
+        time_kernel("spiral", [&](const UpdateKernels& k, int i, double* out) { k.spiral(agents[0], agents[i], 1.5, -0.4, out, BLOCK_AREA); });
+        time_kernel("shift_clamp", [&](const UpdateKernels& k, int i, double* out) { k.shift_clamp(agents[i], 3.0, -10, 10, out, BLOCK_AREA); });
+    }
+
+    // Все метаэвристики из реестра на одних и тех же блоках и популяциях с одинаковым бюджетом
+    const int OPTIMIZER_BLOCKS = 8;
+    for (const auto& [name, factory] : optimizer_registry()) {
+        mt19937 gen(2023);
+        RandomStream stream(stream_key(2023, hash_name(name), 0, 0));
+        double total_ms = 0, total_fitness = 0;
+        for (int b = 0; b < OPTIMIZER_BLOCKS; b++) {
+            vector<vector<int>> pixel_matrix = benchmark_block(gen);
+            uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+            vector<vector<double>> dct_matrix = do_dct(pixel_matrix);
+            DomainMetric<FrequencyDomain> metric(pixel_matrix, bits, 10, 'A');
+            unique_ptr<Optimizer> optimizer = create_optimizer(factory, generate_population_dct(dct_matrix, embed_to_dct(dct_matrix, bits), 32, 0.9, 10),
+                                                      OptimizerBudget{32, 32, 64, 10, 4, StopCriteria()});
+            auto start = chrono::steady_clock::now();
+            total_fitness += optimizer->optimize(metric).first;
+            total_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        }
+        cout << name << ": " << total_ms / OPTIMIZER_BLOCKS << " ms/block, mean fitness " << total_fitness / OPTIMIZER_BLOCKS << '\n';
+    }
+    // DE с полной и инкрементальной оценкой потомков на одних и тех же блоках
+    for (const string& method : methods)
+        for (bool incremental : {false, true}) {
+            mt19937 gen(2023);
+            RandomStream stream(stream_key(2023, hash_name("de"), 0, 0));
+            CostAccumulator cost;
+            CostScope cost_scope(&cost);
+            double total_ms = 0, total_fitness = 0;
+            for (int b = 0; b < OPTIMIZER_BLOCKS; b++) {
+                vector<vector<int>> pixel_matrix = benchmark_block(gen);
+                uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+                vector<vector<double>> dct_matrix = do_dct(pixel_matrix);
+                vector<vector<double>> dct_matrix_new = embed_to_dct(dct_matrix, bits);
+                unique_ptr<Metric> metric = find_metric(method)(pixel_matrix, bits, 10, 'A');
+                if (incremental)
+                    metric->enable_incremental();
+                DE de(method == "spatial" ? generate_population(pixel_matrix, undo_dct(dct_matrix_new), 32, 0.9, 10)
+                                          : generate_population_dct(dct_matrix, dct_matrix_new, 32, 0.9, 10), 32, 128, 64);
+                auto start = chrono::steady_clock::now();
+                total_fitness += de.optimize(*metric).first;
+                total_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            }
+            Cost total = cost.snapshot();
+            cout << "de " << method << (incremental ? " incremental: " : " full: ") << total_ms / OPTIMIZER_BLOCKS
+                 << " ms/block, mean fitness " << total_fitness / OPTIMIZER_BLOCKS << ", incremental " << total.incremental
+                 << " of " << total.evaluations << " evals, idct " << total.idct << ", dct " << total.dct << '\n';
+        }
+    // Отсев кандидатов по предсказанию метрики: доля блоков, в которые встроена вся порция, против числа полных оценок
+    for (const string name : {"tlbo", "sca", "woa", "aoa"})
+        for (double ratio : {1.0, 0.5, 0.25}) {
+            mt19937 gen(2023);
+            RandomStream stream(stream_key(2023, hash_name(name), 0, 0));
+            CostAccumulator cost;
+            CostScope cost_scope(&cost);
+            double total_ms = 0, total_fitness = 0;
+            int successes = 0;
+            for (int b = 0; b < OPTIMIZER_BLOCKS; b++) {
+                vector<vector<int>> pixel_matrix = benchmark_block(gen);
+                uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+                vector<vector<double>> dct_matrix = do_dct(pixel_matrix);
+                DomainMetric<FrequencyDomain> metric(pixel_matrix, bits, 10, 'A');
+                metric.enable_screening(ratio);
+                unique_ptr<Optimizer> optimizer = create_optimizer(find_optimizer(name),
+                                                          generate_population_dct(dct_matrix, embed_to_dct(dct_matrix, bits), 32, 0.9, 10),
+                                                          OptimizerBudget{32, 64, 64, 10, 4, StopCriteria()});
+                auto start = chrono::steady_clock::now();
+                double fitness = optimizer->optimize(metric).first;
+                successes += fitness > 1;
+                total_fitness += fitness;
+                total_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            }
+            Cost total = cost.snapshot();
+            cout << name << " screening " << ratio << ": success " << successes << '/' << OPTIMIZER_BLOCKS
+                 << ", " << total.evaluations / OPTIMIZER_BLOCKS << " evals/block (" << total.screened / OPTIMIZER_BLOCKS
+                 << " screened), mean fitness " << total_fitness / OPTIMIZER_BLOCKS
+                 << ", " << total_ms / OPTIMIZER_BLOCKS << " ms/block\n";
+        }
+    // Быстрый путь: доля блоков, в которые порция встраивается проекцией без метаэвристики
+    for (const string& method : methods) {
+        mt19937 gen(2023);
+        EmbedContext ctx{nullptr, method, "", nullptr, find_metric(method), 10, 2023, 0, StopCriteria(), 0, false, 1.0, 8,
+                         EmbeddabilityThresholds()};
+        CostAccumulator cost;
+        CostScope cost_scope(&cost);
+        int projected = 0;
+        double total_fitness = 0;
+        auto start = chrono::steady_clock::now();
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            vector<vector<int>> pixel_matrix = benchmark_block(gen);
+            uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+            double fitness = project_block(ctx, pixel_matrix, bits, 'A', ctx.search_space).first;
+            if (fitness > 1) {
+                projected++;
+                total_fitness += fitness;
+            }
+        }
+        double total_us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        Cost total = cost.snapshot();
+        cout << "projection " << method << ": " << projected << '/' << NUM_BLOCKS << " blocks, mean fitness "
+             << total_fitness / max(projected, 1) << ", " << total_us / NUM_BLOCKS << " us/block, idct "
+             << total.idct << ", dct " << total.dct << '\n';
+    }
+    // Предсказатель embeddable на блоках у границы диапазона: блоки, которые проекция не встроила,
+    // все равно оптимизируются DE, чтобы сравнить предсказание с итогом: пропуск блока, в который DE порцию
+    // не встроила, экономит оценки, а пропуск блока, в который встроила, - потерянная емкость
+    for (const string& method : methods) {
+        mt19937 gen(3);
+        RandomStream stream(stream_key(2023, hash_name("embeddability"), 0, 0));
+        StopCriteria stop;
+        stop.plateau_generations = 16;
+        stop.plateau_psnr = 0.01;
+        EmbedContext ctx{nullptr, method, "de", find_optimizer("de"), find_metric(method), 10, 2023, 0, stop, 1024, true, 1.0, 8,
+                         EmbeddabilityThresholds()};
+        int optimized = 0, failed = 0, skipped = 0, skipped_failed = 0, lost = 0;
+        long long avoided = 0, wasted = 0;
+        for (int b = 0; b < NUM_BLOCKS; b++) {
+            vector<vector<int>> pixel_matrix = saturated_block(gen);
+            uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+            if (project_block(ctx, pixel_matrix, bits, 'A', ctx.search_space).first > 1)
+                continue;
+            bool skip = !embeddable(pixel_matrix, bits, ctx.embeddability);
+            CostAccumulator cost;
+            CostScope cost_scope(&cost);
+            bool embedded = optimize_block(ctx, pixel_matrix, bits, 128, stop).first > 1;
+            long long evaluations = cost.snapshot().evaluations;
+            optimized++;
+            failed += !embedded;
+            wasted += embedded ? 0 : evaluations;
+            if (skip) {
+                skipped++;
+                skipped_failed += !embedded;
+                lost += embedded;
+                avoided += embedded ? 0 : evaluations;
+            }
+        }
+        cout << "embeddability " << method << ": " << optimized << " of " << NUM_BLOCKS << " blocks not projected, " << failed
+             << " failed (" << wasted << " evals); predicted " << skipped << ", of them failed " << skipped_failed
+             << ", evaluations avoided " << avoided << ", lost capacity " << lost << " blocks\n";
+    }
+    // Модель островов и гонка портфеля против одиночных метаэвристик на блоках, которые проекция не встроила,
+    // при одних и тех же условиях остановки: как в main (плато psnr) и до первого встраивания (target_fitness 1)
+    {
+        const int HARD_BLOCKS = 16;
+        vector<vector<vector<int>>> hard_blocks;
+        vector<uint32_t> hard_bits;
+        mt19937 gen(11);
+        EmbedContext probe{nullptr, "frequency", "", nullptr, find_metric("frequency"), 10, 2023, 0, StopCriteria(), 0, false, 1.0, 8,
+                           EmbeddabilityThresholds()};
+        while (hard_blocks.size() < HARD_BLOCKS) {
+            vector<vector<int>> pixel_matrix = saturated_block(gen);
+            uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+            if (project_block(probe, pixel_matrix, bits, 'A', 10).first <= 1) {
+                hard_blocks.push_back(pixel_matrix);
+                hard_bits.push_back(bits);
+            }
+        }
+        for (const char* until : {"plateau", "target"}) {
+            OptimizerBudget budget{128, 128, 64, 10, 10, StopCriteria()};
+            budget.stop.plateau_generations = 16;
+            budget.stop.plateau_psnr = 0.01;
+            if (string(until) == "target")
+                budget.stop.target_fitness = 1;
+            for (const string name : {"tlbo", "de", "woa", "islands", "portfolio"}) {
+                RandomStream stream(stream_key(2023, hash_name(name), 0, 0));
+                CostAccumulator cost;
+                CostScope cost_scope(&cost);
+                int successes = 0;
+                double total_fitness = 0;
+                map<string, int> wins;
+                auto start = chrono::steady_clock::now();
+                for (int b = 0; b < HARD_BLOCKS; b++) {
+                    vector<vector<double>> dct_matrix = do_dct(hard_blocks[b]);
+                    DomainMetric<FrequencyDomain> metric(hard_blocks[b], hard_bits[b], 10, 'A');
+                    unique_ptr<Optimizer> optimizer = create_optimizer(find_optimizer(name),
+                        generate_population_dct(dct_matrix, embed_to_dct(dct_matrix, hard_bits[b]), 128, 0.9, 10), budget);
+                    double fitness = optimizer->optimize(metric).first;
+                    successes += fitness > 1;
+                    total_fitness += fitness;
+                    if (!optimizer->stop_report.winner.empty())
+                        wins[optimizer->stop_report.winner]++;
+                }
+                double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                cout << name << " on hard blocks until " << until << ": success " << successes << '/' << HARD_BLOCKS
+                     << ", mean fitness " << total_fitness / HARD_BLOCKS << ", " << cost.snapshot().evaluations / HARD_BLOCKS
+                     << " evals/block, " << total_ms / HARD_BLOCKS << " ms/block (" << thread_pool().size() << " threads)";
+                for (const auto& [winner, count] : wins)
+                    cout << ' ' << winner << ' ' << count;
+                cout << '\n';
+            }
+        }
+
+        // Режим портфеля (main ... portfolio) на картинке из тех же блоков: два запуска с одним seed
+        // должны дать одинаковые победителей, значения метрики и пиксели (число оценок может отличаться)
+        Image picture(BLOCK_SIZE, BLOCK_SIZE * HARD_BLOCKS);
+        for (int b = 0; b < HARD_BLOCKS; b++)
+            for (int i = 0; i < BLOCK_SIZE; i++)
+                for (int j = 0; j < BLOCK_SIZE; j++)
+                    picture.block(b)(i, j) = hard_blocks[b][i][j];
+        BitVector information;
+        for (int i = 0; i < 32 * HARD_BLOCKS; i++)
+            information.push_back(gen() & 1);
+        vector<int> blocks(HARD_BLOCKS);
+        iota(blocks.begin(), blocks.end(), 0);
+        EmbedContext ctx{&picture, "frequency", "portfolio", find_optimizer("portfolio"), find_metric("frequency"), 10, 2023,
+                         hash_name("portfolio"), StopCriteria(), 0, false, 1.0, 8, EmbeddabilityThresholds()};
+        ctx.stop.plateau_generations = 16;
+        ctx.stop.plateau_psnr = 0.01;
+        vector<BlockResult> runs[2];
+        for (vector<BlockResult>& run : runs)
+            run = embed_blocks(ctx, blocks, information, thread_pool());
+        int embedded = 0;
+        bool same = true;
+        map<string, int> wins;
+        for (int b = 0; b < HARD_BLOCKS; b++) {
+            const BlockResult& first = runs[0][b];
+            const BlockResult& second = runs[1][b];
+            embedded += first.embedded;
+            if (!first.stop.winner.empty())
+                wins[first.stop.winner]++;
+            same = same && first.fitness == second.fitness && first.stop.winner == second.stop.winner &&
+                   first.pixels == second.pixels;
+        }
+        cout << "portfolio mode: embedded " << embedded << '/' << HARD_BLOCKS << ", wins";
+        for (const auto& [winner, count] : wins)
+            cout << ' ' << winner << ' ' << count;
+        cout << (same ? ", reproducible\n" : ", results differ between runs\n");
+        if (!same) {
+            cout << "error: portfolio race is not reproducible for a fixed seed\n";
+            status = 1;
+        }
+    }
+#ifdef COUNT_ALLOCATIONS
+    // Выделения памяти в установившемся режиме: разность между запусками на 2 и 6 поколений,
+    // деленная на 4, - это выделения на одно поколение внутреннего цикла метаэвристики
+    // Метрика с пространством поиска 0 не дает изменить блок, порция не встраивается, поэтому
+    // ни одна метаэвристика (и острова с портфелем) не останавливается досрочно - проверяется по stop_report
+    mt19937 gen(7);
+    vector<vector<int>> pixel_matrix = benchmark_block(gen);
+    uint32_t bits = EMBED_FLAG | (uint32_t(gen()) >> 1);
+    vector<vector<double>> dct_matrix = do_dct(pixel_matrix);
+    Population population = generate_population_dct(dct_matrix, embed_to_dct(dct_matrix, bits), 32, 0.9, 10);
+    DomainMetric<FrequencyDomain> metric(pixel_matrix, bits, 0, 'A');
+    for (const auto& [name, factory] : optimizer_registry()) {
+        long long allocations[2];
+        int iterations[2] = {2, 6};
+        bool full_budget = true;
+        for (int k = 0; k < 2; k++) {
+            OptimizerBudget budget{32, iterations[k], 64, 10, 4, StopCriteria()};
+            unique_ptr<Optimizer> optimizer = factory(population, budget);
+            long long before = allocation_count;
+            optimizer->optimize(metric);
+            allocations[k] = allocation_count - before;
+            full_budget = full_budget && optimizer->stop_report.generations == iterations[k];
+        }
+        double per_iteration = double(allocations[1] - allocations[0]) / 4;
+        cout << name << ": " << per_iteration << " allocations per iteration\n";
+        if (!full_budget) {
+            cout << "error: " << name << " stopped early, allocations per iteration are not comparable\n";
+            status = 1;
+        }
+        else if (per_iteration != 0) { // внутренний цикл метаэвристики не должен выделять (и освобождать) память
+            cout << "error: " << name << " allocates memory in the steady state\n";
+            status = 1;
+        }
+    }
+#endif
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench")
+        return run_benchmark();
+
+    // seed эксперимента: задается первым аргументом (main 12345), иначе выбирается случайно
+    // все случайные решения выводятся из него, поэтому запуск с тем же seed повторяет результаты
+    uint64_t seed = (argc > 1) ? stoull(argv[1]) : (uint64_t(random_device()()) << 32) ^ random_device()();
+    cout << "seed " << seed << '\n';
+    // число потоков: второй аргумент (main 12345 8), по умолчанию - по числу ядер
+    thread_pool(argc > 2 ? stoul(argv[2]) : 0);
+
     vector <string> pictures{                             "peppers512.png","lena512.png",
                              "airplane512.png","baboon512.png","barbara512.png",
                              "boat512.png","goldhill512.png","stream_and_bridge512.png"
@@ -1185,8 +4238,45 @@ int main() {
     vector <string> metaheu{
         "sca","tlbo","ica","aoa","ssa","woa","de"
     };
+    // режим портфеля: третий аргумент portfolio (main 12345 8 portfolio) - вместо отдельного прохода каждой
+    // метаэвристики по всем картинкам метаэвристики соревнуются на каждом блоке (PORTFOLIO), декодирование
+    // и DCT делаются один раз; при том же seed итог воспроизводится (см. PORTFOLIO)
+    if (argc > 3 && string(argv[3]) != "portfolio")
+        throw invalid_argument(string("unknown mode: ") + argv[3]);
+    const bool PORTFOLIO_MODE = argc > 3;
+    if (PORTFOLIO_MODE)
+        metaheu = {"portfolio"};
     string method = "frequency";
 //    string method = "spatial";
+    // расположение пикселей изображений в памяти: поблочное ускоряет обход блоков в случайном порядке
+    const ImageLayout IMAGE_LAYOUT = LAYOUT_TILED;
+    // число итераций предварительного прохода, выбирающего блоки-носители (0 - без него, блоки обрабатываются по порядку)
+    const int PROBE_ITERATIONS = 0;
+    // досрочная остановка метаэвристик: информация встроена, а psnr за 16 поколений вырос меньше чем на 0.01 дБ
+    // (остановка по застою не включается: она может прервать блок до встраивания и уменьшить объем встроенного)
+    StopCriteria STOP;
+    STOP.plateau_generations = 16;
+    STOP.plateau_psnr = 0.01;
+    // кэш оценок особей в каждом блоке: сошедшиеся популяции часто оценивают одни и те же особи (0 - без кэша)
+    // Только в пространственной области: там особи округляются до целых и повторяются, а в частотной
+    // непрерывные особи почти не повторяются и кэш только тратит память и время на хэш и блокировку
+    const size_t EVAL_CACHE_ENTRIES = method == "spatial" ? 1024 : 0;
+    // инкрементальная оценка потомков DE от состояния родителя - только в пространственной области:
+    // в частотной потомок отличается от родителя во многих коэффициентах, инкрементальный путь редко
+    // применим и вместе с повторной полной проверкой идеальных потомков медленнее полной оценки
+    const bool INCREMENTAL_EVALUATION = method == "spatial";
+    // быстрый путь: до 8 шагов проекции перед метаэвристикой (0 - только метаэвристика)
+    const int PROJECTION_STEPS = 8;
+    // блоки, в которые порция не встроится (выход пикселей за [0, 255] больше 28 или все пиксели равны 0 или 255),
+    // сразу получают бит-флаг 0; выключено: при текущем STOP в частотной области DE встраивает порции и в блоки,
+    // которые предсказатель пропускает (bench: "lost capacity"), включать только при lost capacity 0
+    EmbeddabilityThresholds EMBEDDABILITY;
+    EMBEDDABILITY.enabled = false;
+    EMBEDDABILITY.max_overflow = 28;
+    EMBEDDABILITY.max_saturated = 1.0;
+    // отсев кандидатов TLBO, SCA, WOA, AOA по предсказанию метрики (только частотная область, 1 - без отсева)
+    const double SCREENING_RATIO = 1.0;
+    vector<PictureCost> cost_report; // затраты по картинкам, сохраняются в cost_report.csv и cost_report.json
     for (int m4 = 0; m4 < metaheu.size(); m4++) {
         string METAHEURISTIC = metaheu[m4];
         cout << METAHEURISTIC << '\n';
@@ -1200,214 +4290,140 @@ int main() {
             int mode = 1;
             if (mode == 1) { // встраивание
                 const int SEARCH_SPACE = 10; // пространство поиска
+                CostAccumulator picture_cost; // затраты вне блоков: чтение, запись, предварительный проход
+                CostScope cost_scope(&picture_cost);
+                auto picture_start = chrono::steady_clock::now();
 
                 //открытие файла, что нужно встроить
                 ifstream inputFile("to_embed.txt");
-                int ind_information = 0;
-                string information;
-                getline(inputFile, information);
+                string information_text;
+                getline(inputFile, information_text);
                 inputFile.close();
+                BitVector information = BitVector::from_string(information_text);
                 //открытие картинки
-                cv::Mat image = cv::imread(picture, cv::IMREAD_GRAYSCALE);
-                int rows = image.rows;
-                int cols = image.cols;
-                vector<vector<int>> img(rows, vector<int>(cols));
-
-                // трансформация из формата <Mat> в <vector>
-                for (int i = 0; i < rows; i++)
-                    for (int j = 0; j < cols; j++)
-                        img[i][j] = static_cast<int>(image.at<uchar>(i, j));
+                PhaseTimer decode_timer(PHASE_DECODE);
+                Image img = Image::read(picture, IMAGE_LAYOUT);
+                decode_timer.stop();
 
                 //генерация порядка блоков, сохранение их в файл
-                vector<int> blocks = generate_blocks(rows * cols / 64);
+                vector<int> blocks;
+                {
+                    RandomStream stream(stream_key(seed, hash_name(picture), BLOCK_ORDER_STREAM, 0));
+                    blocks = generate_blocks(img.block_count());
+                }
+                ofstream seedFile(picture + METAHEURISTIC + "/seed.txt");
+                seedFile << seed;
+                seedFile.close();
                 ofstream outputFile(picture + METAHEURISTIC + "/blocks.txt");
                 for (int num: blocks)
                     outputFile << num << ' ';
                 outputFile.close();
 
-                vector<vector<int>> copy_img = img;
-                int cnt1 = 0;
-                int cnt_blocks = 0;
-
-                for (int i : blocks) {
-                    cout << endl << cnt_blocks++ << ' ' << endl;
-                    //получаем блок изображения по известному номера блока
-                    int block_w = i % (rows / 8);
-                    int block_h = (i - block_w) / (rows / 8);
-                    vector<vector<int>> pixel_matrix(8, vector<int>(8));
-                    for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++)
-                        for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++)
-                            pixel_matrix[i1 - block_h * 8][i2 - block_w * 8] = img[i1][i2];
-
-                    //трансформация из пикселей в DCT-coef
-                    vector<vector<double>> dct_matrix;
-                    vector<vector<double>> dct_matrix_new;
-                    dct_matrix = do_dct(pixel_matrix);
-
-                    //встраивание информации в DCT-coef блок
-                    dct_matrix_new = embed_to_dct(dct_matrix, string(1, '1') + information.substr(ind_information, 31));
-
-                    vector<vector<double>> population;
-                    if (method == "spatial"){
-                    //перевод блока из DCT-coef в пиксельный формат
-                    vector<vector<int>> new_pixel_matrix = undo_dct(dct_matrix_new);
-
-                    //генерация популяции на основе блока после встраивания и изначального
-                    population = generate_population(pixel_matrix, new_pixel_matrix, 128,
-                                                                            double(0.9), SEARCH_SPACE);
-                    }
-
-                    else if (method == "frequency"){
-                        population = generate_population_dct(dct_matrix, dct_matrix_new, 128,
-                                                                                double(0.9), SEARCH_SPACE);
-                    }
-                    //задаем объект метрики для данного блока и информации для встраивания
-                    Metric metric(pixel_matrix, string(1, '1') + information.substr(ind_information, 31), SEARCH_SPACE,
-                                  'A',method);
-                    //выбор метаэвристики и оптимизации с помощью нее
-                    pair<double, vector<double>> solution;
-                    if (METAHEURISTIC == "tlbo") {
-                        TLBO meta(population, 128, 128, 64);
-                        solution = meta.optimize(metric);
-                    }
-                    else if(METAHEURISTIC == "sca") {
-                        SCA meta(population, 128, 128, 64);
-                        solution = meta.optimize(metric);
-                    }
-                    else if(METAHEURISTIC == "de") {
-                        DE meta(population, 128, 128, 64);
-                        solution = meta.optimize(metric);
-                    }
-                    else if (METAHEURISTIC == "ssa") {
-                        SSA meta(population, SEARCH_SPACE, 128, 128, 64);
-                        solution = meta.optimize(metric);
-                    }
-                    else if (METAHEURISTIC == "woa") {
-                        WOA meta(population, 128, 128, 64, SEARCH_SPACE);
-                        solution = meta.optimize(metric);
-                    }
-                    else if (METAHEURISTIC == "aoa") {
-                        AOA meta(population, 128, 128, 64, SEARCH_SPACE);
-                        solution = meta.optimize(metric);
-                    }
-                    else if (METAHEURISTIC == "ica") {
-                        ICA meta(population, 128, 128, 64, SEARCH_SPACE, 10);
-                        solution = meta.optimize(metric);
+                // встраивание во все блоки, блоки оптимизируются параллельно
+                EmbedContext ctx{&img, method, METAHEURISTIC, find_optimizer(METAHEURISTIC), find_metric(method), SEARCH_SPACE, seed, hash_name(picture), STOP,
+                                 EVAL_CACHE_ENTRIES, INCREMENTAL_EVALUATION, SCREENING_RATIO,
+                                 PROJECTION_STEPS, EMBEDDABILITY};
+                vector<BlockResult> results;
+                PictureCost picture_report;
+                if (PROBE_ITERATIONS > 0) {
+                    vector<char> carriers = predict_carriers(ctx, blocks, information, thread_pool(), PROBE_ITERATIONS);
+                    cout << "carriers " << count(carriers.begin(), carriers.end(), 1) << '\n';
+                    results = embed_blocks(ctx, blocks, information, thread_pool(), &carriers, &picture_report.discarded);
+                }
+                else
+                    results = embed_blocks(ctx, blocks, information, thread_pool(), nullptr, &picture_report.discarded);
+
+                PhaseTimer write_timer(PHASE_WRITE);
+                Image copy_img = img;
+                int cnt1 = 0, cnt_projected = 0, cnt_optimized = 0, cnt_skipped = 0, cnt_no_payload = 0, cnt_flag_projected = 0;
+                int cnt_failed = 0;
+                long long evaluations = 0, evaluations_saved = 0, cache_hits = 0, failed_evaluations = 0;
+                for (size_t cnt_blocks = 0; cnt_blocks < blocks.size(); cnt_blocks++) {
+                    cout << endl << cnt_blocks << ' ' << endl;
+                    const BlockResult& result = results[cnt_blocks];
+                    // сколько оценок особей потрачено и сэкономлено досрочной остановкой
+                    cout << "evaluations " << result.stop.evaluations << " saved " << result.stop.evaluations_saved
+                         << " (" << result.stop.reason << ")\n";
+                    evaluations += result.stop.evaluations;
+                    evaluations_saved += result.stop.evaluations_saved;
+                    cache_hits += result.cost.cache_hits;
+                    picture_report.blocks.push_back({blocks[cnt_blocks], result.embedded, result.payload_projected, result.optimized,
+                                                     result.skipped, result.flag_projected, result.fitness, result.stop.generations,
+                                                     result.cost, result.stop.winner});
+                    if (result.payload_projected)
+                        cnt_projected += 1;
+                    if (result.optimized)
+                        cnt_optimized += 1;
+                    if (result.flag_projected)
+                        cnt_flag_projected += 1;
+                    if (result.skipped)
+                        cnt_skipped += 1;
+                    if (result.chunk == NO_CHUNK)
+                        cnt_no_payload += 1;
+                    if (result.optimized && !result.embedded) { // метаэвристика не встроила порцию
+                        cnt_failed += 1;
+                        failed_evaluations += result.stop.evaluations;
                     }
-                    if (solution.first > 1) { // значение кач-ва метрики >1 => информация встроена идеально, сохраняем новый блок, добавляя к нему матрицу изменений
+                    if (result.embedded)
                         cnt1 += 1;
-                        if (method == "frequency"){
-                            vector<vector<double>> dct_coef_block = do_dct(pixel_matrix);
-                            int ind_fl = 0;
-                            for (int i10 = 0; i10 < 8; i10++) {
-                                for (int j10 = 0; j10 < 8; j10++) {
-                                    dct_coef_block[i10][j10] -= solution.second[ind_fl]; ///asdasd
-                                    ind_fl++;
-                                }
-                            }
-                            vector<vector<int>> new_block = undo_dct(dct_coef_block);
-                            for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++) {
-                                for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++) {
-                                    copy_img[i1][i2] = new_block[i1-block_h*8][i2-block_w*8];
-                                }
-                            }
-                        }
-
-                        else{
-                            int ind = 0;
-                            for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++) {
-                                for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++) {
-                                    copy_img[i1][i2] -= solution.second[ind];
-                                    ind++;
-                                }
-                            }
-                        }
-                        ind_information += 31; // переход к следующей части информации
-                    }
-                    else { // информация встроена неидеально
-                        cout << solution.first;
-                        int searching = 5;
-                        // встраиваем 1 бит - 0
-                        dct_matrix = do_dct(pixel_matrix);
-                        dct_matrix_new = embed_to_dct(dct_matrix, string(1, '0'), 'Z');
-                        if (method == "spatial"){
-                            //перевод блока из DCT-coef в пиксельный формат
-                            vector<vector<int>> new_pixel_matrix = undo_dct(dct_matrix_new);
-
-                            //генерация популяции на основе блока после встраивания и изначального
-                            population = generate_population(pixel_matrix, new_pixel_matrix, 128,
-                                                             double(0.9), searching);
-                        }
-
-                        else if (method == "frequency"){
-                            population = generate_population_dct(dct_matrix, dct_matrix_new, 128,
-                                                                 double(0.9), searching);
-                        }
-
-                        //создание объекта метрики, с учетом встраивание 1 бита
-                        Metric metric(pixel_matrix, string(1, '0'), searching, 'Z',method);
-
-                        // оптимизация с помощью метаэвристики SCA
-                        SCA sca(population, 128, 128, 64);
-                        pair<double, vector<double>> solution = sca.optimize(metric, 1);
-
+                    else { // информация встроена неидеально, в блок встроен бит-флаг 0
+                        cout << result.fitness;
                         for (int i1 = 0; i1 < 64; i1++)
-                            cout << solution.second[i1] << ' ';
-                        //сохраняем блок, в который не встраивалась информация
-                        if (method == "frequency"){
-                            vector<vector<double>> dct_coef_block = do_dct(pixel_matrix);
-                            int ind_fl = 0;
-                            for (int i1 = 0; i1 < 8; i1++) {
-                                for (int j1 = 0; j1 < 8; j1++) {
-                                    dct_coef_block[i1][j1] -= solution.second[ind_fl];
-                                    ind_fl++;
-                                }
-                            }
-                            vector<vector<int>> new_block = undo_dct(dct_coef_block);
-                            for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++) {
-                                for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++) {
-                                    copy_img[i1][i2] = new_block[i1-block_h*8][i2-block_w*8];
-                                }
-                            }
-                        }
-
-                        else{
-                            int ind = 0;
-                            for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++) {
-                                for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++) {
-                                    copy_img[i1][i2] -= solution.second[ind];
-                                    ind++;
-                                }
-                            }
-                        }
+                            cout << result.solution[i1] << ' ';
                     }
-
+                    // сохраняем новый блок в изображение
+                    copy_img.block(blocks[cnt_blocks]).scatter(result.pixels);
                 }
 
                 //сохраняем изображение
-                cv::Mat imageMat(rows, cols, CV_8UC1);
-                for (int row = 0; row < rows; row++)
-                    for (int col = 0; col < cols; col++)
-                        imageMat.at<uchar>(row, col) = static_cast<uchar>(copy_img[row][col]);
                 string outputFilePath = picture + METAHEURISTIC + "/saved.png";
-                bool success = cv::imwrite(outputFilePath, imageMat);
-
-                cout << cnt1;
+                bool success = copy_img.write(outputFilePath);
+                write_timer.stop();
+
+                cout << cnt1 << '\n';
+                // пропущенный блок сэкономил бы столько оценок, сколько в среднем тратится на неудачную порцию
+                // (если неудачных порций не было - весь бюджет метаэвристики); встроила бы метаэвристика порцию
+                // в пропущенный блок, здесь неизвестно, поэтому это верхняя граница - пропущенный блок, в который
+                // порция встроилась бы, оценок не экономит, а теряет емкость (доля таких блоков - в bench)
+                long long evaluations_avoided = cnt_skipped * (cnt_failed ? failed_evaluations / cnt_failed : 128LL * 128);
+                cout << "projected " << cnt_projected << " optimized " << cnt_optimized << " flag projected " << cnt_flag_projected << '\n';
+                cout << "skipped " << cnt_skipped << " no payload " << cnt_no_payload << " evaluations avoided at most " << evaluations_avoided << '\n';
+                if (METAHEURISTIC == "portfolio") { // какие метаэвристики выигрывали гонку
+                    map<string, int> wins;
+                    for (const BlockResult& result : results)
+                        if (!result.stop.winner.empty())
+                            wins[result.stop.winner]++;
+                    cout << "wins";
+                    for (const auto& [name, count] : wins)
+                        cout << ' ' << name << ' ' << count;
+                    cout << '\n';
+                }
+                cout << "evaluations " << evaluations << " saved " << evaluations_saved << " cache hits " << cache_hits << '\n';
+
+                // отчет о затратах: блоки, пересчитанные блоки и то, что вне блоков
+                picture_report.metaheuristic = METAHEURISTIC;
+                picture_report.picture = picture;
+                picture_report.embedded = cnt1;
+                picture_report.projected = cnt_projected;
+                picture_report.optimized = cnt_optimized;
+                picture_report.flag_projected = cnt_flag_projected;
+                picture_report.skipped = cnt_skipped;
+                picture_report.no_payload = cnt_no_payload;
+                picture_report.evaluations_avoided = evaluations_avoided;
+                picture_report.wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - picture_start).count();
+                picture_report.total = picture_cost.snapshot();
+                picture_report.total += picture_report.discarded;
+                for (const BlockCost& block : picture_report.blocks)
+                    picture_report.total += block.cost;
+                cost_report.push_back(picture_report);
+                write_cost_report("cost_report", seed, cost_report);
             }
             mode = 2;
             if (mode == 2) { // извлечение
-                string bit_string = "";
+                BitVector bit_string;
 
                 //открываем изображение
-                cv::Mat image = cv::imread(picture + METAHEURISTIC + "/saved.png", cv::IMREAD_GRAYSCALE);
-                int rows = image.rows;
-                int cols = image.cols;
-                vector<vector<int>> img(rows, vector<int>(cols));
-
-                // переводим из формата <Mat> в <vector>
-                for (int i = 0; i < rows; i++)
-                    for (int j = 0; j < cols; j++)
-                        img[i][j] = static_cast<int>(image.at<uchar>(i, j));
+                const Image img = Image::read(picture + METAHEURISTIC + "/saved.png", IMAGE_LAYOUT);
 
                 // открываем файл с порядком блоков
                 ifstream inputFile(picture + METAHEURISTIC + "/blocks.txt");
@@ -1417,33 +4433,32 @@ int main() {
                     blocks.push_back(num);
                 }
                 inputFile.close();
-                for (int i: blocks) {
+                // собираем все блоки в пакет и переводим их в DCT-coef за один проход
+                vector<double> dct_blocks(BLOCK_AREA * blocks.size());
+                for (size_t b = 0; b < blocks.size(); b++) {
                     // получаем значения блока изображения по прочитанному номеру блоку
-                    int block_w = i % (rows / 8);
-                    int block_h = (i - block_w) / (rows / 8);
-                    vector<vector<int>> pixel_matrix(8, vector<int>(8));
-                    for (int i1 = block_h * 8; i1 < block_h * 8 + 8; i1++)
-                        for (int i2 = block_w * 8; i2 < block_w * 8 + 8; i2++)
-                            pixel_matrix[i1 - block_h * 8][i2 - block_w * 8] = img[i1][i2];
+                    BlockView<const uint8_t> view = img.block(blocks[b]);
+                    for (int i1 = 0; i1 < 8; i1++)
+                        for (int i2 = 0; i2 < 8; i2++)
+                            dct_blocks[(i1 * 8 + i2) * blocks.size() + b] = view(i1, i2);
+                }
+                dct_8x8_batch(dct_blocks.data(), dct_blocks.data(), blocks.size());
 
+                for (size_t b = 0; b < blocks.size(); b++) {
                     // извлекаем информацию из блока
-                    string s = extracting_dct(pixel_matrix);
-                    if (s != "0") // информация должна быть извлечена
-                        bit_string += s.substr(1);
+                    Block dct_block;
+                    block_from_soa(dct_blocks.data(), blocks.size(), b, dct_block.data());
+                    uint32_t bits;
+                    if (extracting_dct(dct_block, bits) == EMBED_BITS) // информация должна быть извлечена
+                        bit_string.append(bits, 31); // 31 бит информации после бита-флага
                 }
                 // сохраняем извлеченную информацию в файл
                 ofstream outputFile(picture + METAHEURISTIC + "/saved.txt");
-                outputFile << bit_string;
+                outputFile << bit_string.to_string();
                 outputFile.close();
 
                 // октрываем изначальное изображение и считаем метрику psnr между изначальным и получившимся
-                cv::Mat image_base = cv::imread(picture, cv::IMREAD_GRAYSCALE);
-                rows = image_base.rows;
-                cols = image_base.cols;
-                vector<vector<int>> img_base(rows, vector<int>(cols));
-                for (int i = 0; i < rows; i++)
-                    for (int j = 0; j < cols; j++)
-                        img_base[i][j] = static_cast<int>(image_base.at<uchar>(i, j));
+                Image img_base = Image::read(picture, IMAGE_LAYOUT);
                 cout << psnr(img_base, img) << ' ' << ssim(img_base, img) << '\n';
             }
             else {
@@ -1451,23 +4466,8 @@ int main() {
                 string route;
                 //cin >> route;
                 route = directoryPath + "/saved.png";
-                cv::Mat image = cv::imread(route, cv::IMREAD_GRAYSCALE);
-                int rows = image.rows;
-                int cols = image.cols;
-                vector<vector<int>> img(rows, vector<int>(cols));
-
-                // переводим из формата <Mat> в <vector>
-                for (int i = 0; i < rows; i++)
-                    for (int j = 0; j < cols; j++)
-                        img[i][j] = static_cast<int>(image.at<uchar>(i, j));
-
-                cv::Mat image_base = cv::imread(picture, cv::IMREAD_GRAYSCALE);
-                rows = image_base.rows;
-                cols = image_base.cols;
-                vector<vector<int>> img_base(rows, vector<int>(cols));
-                for (int i = 0; i < rows; i++)
-                    for (int j = 0; j < cols; j++)
-                        img_base[i][j] = static_cast<int>(image_base.at<uchar>(i, j));
+                Image img = Image::read(route, IMAGE_LAYOUT);
+                Image img_base = Image::read(picture, IMAGE_LAYOUT);
 
                 ifstream inputFile(directoryPath + "/saved.txt");
                 string line;